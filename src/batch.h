@@ -0,0 +1,351 @@
+#pragma once
+
+#include "bitboard.h"
+#include "board.h"
+#include "movegen.h"
+
+//  Batched move generation for many unrelated positions at once. The positions are loaded into the
+//  lanes of vectors of bitboards (2 lanes with SSE, 4 with AVX2, 8 with AVX-512), and everything that
+//  generate_moves computes up front (enemy attacks, checks, pins and the pawn masks) is computed for
+//  every lane at the same time.
+//
+//  Table lookups don't vectorise well, so sliding pieces are handled with Kogge-Stone occluded
+//  fills instead: all sliders of a lane are filled in one direction at once, in three shift steps.
+//  This also allows moves to be counted without looping over pieces. In a single direction, the
+//  rays of two friendly sliders never overlap (the nearer one blocks the other), so the number of
+//  moves in that direction is just the popcount of the fill of all of them together.
+//    (Reference: https://www.chessprogramming.org/Kogge-Stone_Algorithm)
+
+#if defined(__AVX512F__)
+#define BATCH_LANES 8
+#elif defined(__AVX2__)
+#define BATCH_LANES 4
+#else
+#define BATCH_LANES 2
+#endif
+
+typedef bitboard lanes __attribute__((vector_size(8 * BATCH_LANES)));
+
+#define LANES(bb) ((lanes) {} + (bitboard)(bb)) // broadcast a bitboard to every lane
+
+// lanes are all ones where the condition is true, and all zeros otherwise
+#define MASK(condition) ((lanes)(condition))
+
+// The shifts must be inlined with constant directions (the loops over directions below are unrolled
+// for the same reason), otherwise every step becomes a branch and a shift by a variable amount.
+#define LANES_INLINE static inline __attribute__((always_inline))
+
+
+// Shift bitboards one step in a direction, discarding any bits that wrap around the board edge.
+// Directions are given by their square offset, as in bitboard.h.
+
+LANES_INLINE lanes shift_lanes(lanes bb, int direction)
+{
+	switch (direction) {
+		case N:   return bb << 8;
+		case S:   return bb >> 8;
+		case E:   return (bb & LANES(~HFILE)) << 1;
+		case W:   return (bb & LANES(~AFILE)) >> 1;
+		case N+E: return (bb & LANES(~HFILE)) << 9;
+		case N+W: return (bb & LANES(~AFILE)) << 7;
+		case S+E: return (bb & LANES(~HFILE)) >> 7;
+		case S+W: return (bb & LANES(~AFILE)) >> 9;
+		default: __builtin_unreachable();
+	}
+}
+
+
+// Squares attacked in a direction by the sliders, stopping at (and including) the first occupied
+// square. Note: the fill is done with the board edge masked out of the empty squares, so no
+// separate wrapping checks are needed while filling.
+
+LANES_INLINE lanes slide_lanes(lanes sliders, lanes empty, int direction)
+{
+	bitboard edge = 0;
+
+	if (direction == E || direction == N+E || direction == S+E) edge = AFILE;
+	if (direction == W || direction == N+W || direction == S+W) edge = HFILE;
+
+	empty &= LANES(~edge);
+	int shift = (direction > 0) ? direction : -direction;
+
+	for (int step = shift; step <= 4 * shift; step *= 2) {
+		if (direction > 0) {
+			sliders |= empty & (sliders << step);
+			empty   &= empty << step;
+		}
+
+		else {
+			sliders |= empty & (sliders >> step);
+			empty   &= empty >> step;
+		}
+	}
+
+	return shift_lanes(sliders, direction);
+}
+
+
+lanes popcnt_lanes(lanes bb)
+{
+#if BATCH_LANES == 8 && defined(__AVX512VPOPCNTDQ__)
+	return (lanes) _mm512_popcnt_epi64((__m512i) bb);
+#else
+	for (int i = 0; i < BATCH_LANES; i += 1) bb[i] = popcnt(bb[i]);
+	return bb;
+#endif
+}
+
+
+lanes extract_lanes(lanes x, lanes y, lanes z, piecetype const piece)
+{
+	if (piece == ROOK)
+		return z &~ y;
+
+	return ((piece & 0x1) ? x : ~x)
+	     & ((piece & 0x2) ? y : ~y)
+	     & ((piece & 0x4) ? z : ~z);
+}
+
+
+lanes knight_lanes(lanes knights)
+{
+	lanes east1 = shift_lanes(knights, E), east2 = shift_lanes(east1, E);
+	lanes west1 = shift_lanes(knights, W), west2 = shift_lanes(west1, W);
+
+	return ((east1 | west1) << 16) | ((east1 | west1) >> 16)
+	     | ((east2 | west2) <<  8) | ((east2 | west2) >>  8);
+}
+
+
+lanes king_lanes(lanes king)
+{
+	lanes row = king | shift_lanes(king, E) | shift_lanes(king, W);
+	return (row | (row << 8) | (row >> 8)) &~ king;
+}
+
+
+static const int orthogonal[4] = { N, S, E, W };
+static const int diagonal[4]   = { N+E, S+W, N+W, S+E };
+
+
+//  The movegen_info of every lane, with the pins split by direction. The pin lines are the lines
+//  from the king up to (and including) the pinning piece, as in movegen_info. Pieces pinned along
+//  a line can still move along it, and sliders are generated by direction, so pins are kept for
+//  each of the four lines through the king (indexed by direction / 2, in the order above).
+
+typedef struct {
+	lanes occ, own, enemy_pieces, empty, en_passant, king;
+	lanes attacked, checks, targets, double_check;
+	lanes orth_pins[2], diag_pins[2], hpinned, vpinned;
+} batch_info;
+
+
+batch_info generate_batch_info(lanes x, lanes y, lanes z, lanes white)
+{
+	batch_info info;
+
+	info.occ   = x | y | z;
+	info.own   = white & info.occ;
+	info.enemy_pieces = info.occ &~ white;
+	info.empty = ~info.occ;
+	info.en_passant = white &~ info.occ;
+	info.king  = extract_lanes(x, y, z, KING) & info.own;
+
+	lanes enemy   = info.enemy_pieces;
+	lanes pawns   = extract_lanes(x, y, z, PAWN)   & enemy;
+	lanes knights = extract_lanes(x, y, z, KNIGHT) & enemy;
+	lanes queens  = extract_lanes(x, y, z, QUEEN)  & enemy;
+	lanes bishops = (extract_lanes(x, y, z, BISHOP) & enemy) | queens;
+	lanes rooks   = (extract_lanes(x, y, z, ROOK)   & enemy) | queens;
+	lanes king    = extract_lanes(x, y, z, KING)   & enemy;
+
+	// Enemy attacks, sliders x-ray through our king (see enemy_attacked)
+	lanes xray_empty = info.empty | info.king;
+
+	info.attacked = shift_lanes(pawns, S+E) | shift_lanes(pawns, S+W) | king_lanes(king) | knight_lanes(knights);
+
+	#pragma GCC unroll 8
+	for (int i = 0; i < 4; i += 1) {
+		info.attacked |= slide_lanes(bishops, xray_empty, diagonal[i]);
+		info.attacked |= slide_lanes(rooks, xray_empty, orthogonal[i]);
+	}
+
+	// Checks and pins, by sliding out from our king in every direction (see generate_pinned)
+	info.checks  = pawns & (shift_lanes(info.king, N+E) | shift_lanes(info.king, N+W));
+	info.checks |= knights & knight_lanes(info.king);
+
+	lanes check_line = info.checks;
+
+	#pragma GCC unroll 8
+	for (int i = 0; i < 8; i += 1) {
+		bool diag = (i >= 4);
+		int direction = diag ? diagonal[i - 4] : orthogonal[i];
+		lanes sliders = diag ? bishops : rooks;
+
+		lanes ray = slide_lanes(info.king, info.empty, direction);
+		lanes blocker = ray & info.own;
+		lanes xray = slide_lanes(info.king, info.empty | blocker, direction);
+
+		lanes checking = MASK((ray & sliders) != 0);
+		lanes pinning  = MASK((xray & sliders &~ ray) != 0) & MASK(blocker != 0);
+
+		info.checks |= ray & sliders;
+		check_line  |= ray & checking;
+
+		lanes pin = xray & pinning;
+		if (diag) info.diag_pins[(i - 4) / 2] = (i & 1) ? info.diag_pins[(i - 4) / 2] | pin : pin;
+		else      info.orth_pins[i / 2]       = (i & 1) ? info.orth_pins[i / 2] | pin : pin;
+	}
+
+	info.hpinned = info.orth_pins[0] | info.orth_pins[1];
+	info.vpinned = info.diag_pins[0] | info.diag_pins[1];
+
+	// A single check must be blocked or captured, only the king can move out of a double check
+	info.double_check = MASK((info.checks & (info.checks - 1)) != 0);
+	info.targets = ~info.own & (check_line | MASK(info.checks == 0)) &~ info.double_check;
+
+	return info;
+}
+
+
+// Count the moves of every lane, in the same way as count_moves.
+
+lanes count_batch_moves(batch_info info, lanes x, lanes y, lanes z)
+{
+	lanes own     = info.own;
+	lanes targets = info.targets;
+	lanes pinned  = info.hpinned | info.vpinned;
+	lanes queens  = extract_lanes(x, y, z, QUEEN) & own;
+	lanes bishops = (extract_lanes(x, y, z, BISHOP) & own) | queens;
+	lanes rooks   = (extract_lanes(x, y, z, ROOK)   & own) | queens;
+	lanes knights = extract_lanes(x, y, z, KNIGHT) & own &~ pinned;
+	lanes pawns   = extract_lanes(x, y, z, PAWN)   & own;
+	lanes total   = LANES(0);
+
+	// knights, pinned knights can never move
+	lanes east1 = shift_lanes(knights, E), east2 = shift_lanes(east1, E);
+	lanes west1 = shift_lanes(knights, W), west2 = shift_lanes(west1, W);
+
+	total += popcnt_lanes((east1 << 16) & targets) + popcnt_lanes((west1 << 16) & targets)
+	       + popcnt_lanes((east1 >> 16) & targets) + popcnt_lanes((west1 >> 16) & targets)
+	       + popcnt_lanes((east2 <<  8) & targets) + popcnt_lanes((west2 <<  8) & targets)
+	       + popcnt_lanes((east2 >>  8) & targets) + popcnt_lanes((west2 >>  8) & targets);
+
+	// sliders, pinned sliders may only move along the line they are pinned on
+	#pragma GCC unroll 8
+	for (int i = 0; i < 4; i += 1) {
+		lanes orth = rooks   & (~pinned | info.orth_pins[i / 2]);
+		lanes diag = bishops & (~pinned | info.diag_pins[i / 2]);
+
+		total += popcnt_lanes(slide_lanes(orth, info.empty, orthogonal[i]) & targets);
+		total += popcnt_lanes(slide_lanes(diag, info.empty, diagonal[i])   & targets);
+	}
+
+	// pawns, see generate_pawn_targets
+	lanes ep = info.en_passant;
+	lanes candidates = pawns & (shift_lanes(ep, S+E) | shift_lanes(ep, S+W));
+	lanes enemy_rooks = (extract_lanes(x, y, z, ROOK) | extract_lanes(x, y, z, QUEEN)) & info.enemy_pieces;
+
+	lanes single = MASK(candidates != 0) & MASK((candidates & (candidates - 1)) == 0);
+	lanes on_rank5 = MASK((info.king & LANES(RANK1 << 32)) != 0);
+	lanes clear = candidates | (ep >> 8);
+	lanes ep_empty = ~((info.occ | ep) &~ clear);
+
+	lanes ep_pinned = (slide_lanes(info.king, ep_empty, E) | slide_lanes(info.king, ep_empty, W)) & enemy_rooks;
+	ep &= ~(single & on_rank5 & MASK(ep_pinned != 0));
+
+	lanes pawn_targets = targets | (ep & (targets << 8));
+	lanes enemy = info.enemy_pieces | ep;
+
+	lanes king_file = info.king;
+	for (int step = 8; step <= 32; step *= 2) king_file |= (king_file << step) | (king_file >> step);
+
+	lanes normal_pawns = pawns &~ pinned;
+	lanes forward = normal_pawns | (pawns & pinned & king_file);
+
+	lanes single_move = (forward << 8) & info.empty;
+	lanes double_move = ((single_move & LANES(RANK3)) << 8) & info.empty;
+
+	lanes east_capture = (shift_lanes(normal_pawns, N+E) | (shift_lanes(pawns & info.vpinned, N+E) & info.vpinned)) & enemy;
+	lanes west_capture = (shift_lanes(normal_pawns, N+W) | (shift_lanes(pawns & info.vpinned, N+W) & info.vpinned)) & enemy;
+
+	single_move  &= pawn_targets;
+	double_move  &= pawn_targets;
+	east_capture &= pawn_targets;
+	west_capture &= pawn_targets;
+
+	lanes promotions = popcnt_lanes(single_move & LANES(RANK8)) + popcnt_lanes(east_capture & LANES(RANK8))
+	                 + popcnt_lanes(west_capture & LANES(RANK8));
+
+	total += popcnt_lanes(single_move &~ LANES(RANK8)) + popcnt_lanes(double_move) + 4 * promotions
+	       + popcnt_lanes(east_capture &~ LANES(RANK8)) + popcnt_lanes(west_capture &~ LANES(RANK8));
+
+	// Nothing but the king can move in double check, the targets are empty so the counts above
+	// are zero in those lanes already. King moves and castling are counted as in count_king_moves.
+
+	total += popcnt_lanes(king_lanes(info.king) &~ (info.attacked | own));
+
+	lanes castles  = extract_lanes(x, y, z, CASTLE);
+	lanes castling = (slide_lanes(info.king, info.empty, E) | slide_lanes(info.king, info.empty, W)) & castles;
+
+	total += MASK((castling & LANES(1 << A1)) != 0) & MASK((info.attacked & LANES(QATT)) == 0) & LANES(1);
+	total += MASK((castling & LANES(1 << H1)) != 0) & MASK((info.attacked & LANES(KATT)) == 0) & LANES(1);
+
+	return total;
+}
+
+
+// Load a batch of (up to BATCH_LANES) boards into lanes, unused lanes repeat the first board.
+
+void load_batch(const board *boards, size_t count, lanes *x, lanes *y, lanes *z, lanes *white)
+{
+	for (size_t i = 0; i < BATCH_LANES; i += 1) {
+		board b = boards[(i < count) ? i : 0];
+		(*x)[i] = b.x, (*y)[i] = b.y, (*z)[i] = b.z, (*white)[i] = b.white;
+	}
+}
+
+
+// Count the legal moves (including pawn pushes) of every board, the same as calling count_moves
+// on each of them.
+
+void count_moves_batch(const board *boards, size_t count, size_t *counts)
+{
+	for (size_t i = 0; i < count; i += BATCH_LANES) {
+		size_t n = (count - i < BATCH_LANES) ? count - i : BATCH_LANES;
+		lanes x, y, z, white;
+
+		load_batch(boards + i, n, &x, &y, &z, &white);
+		lanes total = count_batch_moves(generate_batch_info(x, y, z, white), x, y, z);
+
+		for (size_t j = 0; j < n; j += 1) counts[i + j] = total[j];
+	}
+}
+
+
+// Generate the legal moves of every board, the same as calling generate_moves on each of them.
+// The movegen_info of each board is computed in lanes, only writing out the moves is scalar.
+
+void generate_moves_batch(const board *boards, size_t count, movebuffer *moves)
+{
+	for (size_t i = 0; i < count; i += BATCH_LANES) {
+		size_t n = (count - i < BATCH_LANES) ? count - i : BATCH_LANES;
+		lanes x, y, z, white;
+
+		load_batch(boards + i, n, &x, &y, &z, &white);
+		batch_info batch = generate_batch_info(x, y, z, white);
+
+		for (size_t j = 0; j < n; j += 1) {
+			movegen_info info = {
+				.attacked   = batch.attacked[j],
+				.targets    = batch.targets[j],
+				.en_passant = batch.en_passant[j],
+				.hpinned    = batch.hpinned[j],
+				.vpinned    = batch.vpinned[j],
+				.king       = ctz(batch.king[j]),
+			};
+
+			generate_moves_from_info(&moves[i + j], info, boards[i + j], batch.checks[j]);
+		}
+	}
+}
@@ -0,0 +1,347 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "bitbase.h"
+#include "corpus.h"
+#include "fen.h"
+#include "hash.h"
+#include "movegen.h"
+#include "perft.h"
+#include "pseudo.h"
+#include "search.h"
+#include "timer.h"
+#include "tracked.h"
+
+//  Benchmarks for the parts of the move generator whose performance depends on the build options,
+//  such as the layout of the sliding attack tables. Build it once for each option to compare them.
+//  Running many processes at once (-p) shows how each option behaves when the caches are shared
+//  with other processes, as they are on a busy engine host, and -x adds a process that does nothing
+//  but thrash the caches. The results of the generators are checked by tests.c, not here.
+
+
+// returns the number of lookups per second, each sample is looked up as both a bishop and a rook
+
+double bench_slider_lookups(double seconds)
+{
+	size_t lookups = 0;
+	bitboard sum = 0;
+	double start = wall_seconds(), end;
+
+	do {
+		for (size_t i = 0; i < count_slider_samples; i += 1) {
+			slider_sample s = slider_samples[i];
+			sum += bishop_attacks(s.sq, s.occ) ^ rook_attacks(s.sq, s.occ);
+		}
+
+		lookups += 2 * count_slider_samples;
+		end = wall_seconds();
+	}
+	while (end - start < seconds);
+
+	// use the result so that the lookups can't be optimised away
+	if (sum == 42) printf(" ");
+	return lookups / (end - start);
+}
+
+
+// returns the number of positions per second that the moves are counted for, either one at a time
+// or in batches of BATCH_LANES positions (see batch.h)
+
+double bench_count_moves(double seconds, bool batched)
+{
+	size_t positions = 0, sum = 0;
+	size_t *counts = malloc(count_board_samples * sizeof *counts);
+	double start = wall_seconds(), end;
+
+	do {
+		if (batched)
+			count_moves_batch(board_samples, count_board_samples, counts);
+
+		else for (size_t i = 0; i < count_board_samples; i += 1)
+			counts[i] = count_moves(board_samples[i]);
+
+		for (size_t i = 0; i < count_board_samples; i += 1)
+			sum += counts[i];
+
+		positions += count_board_samples;
+		end = wall_seconds();
+	}
+	while (end - start < seconds);
+
+	free(counts);
+	if (sum == 42) printf(" ");
+	return positions / (end - start);
+}
+
+
+// returns the number of positions per second written to FEN and parsed back
+
+double bench_fen(double seconds)
+{
+	size_t positions = 0;
+	bitboard sum = 0;
+	double start = wall_seconds(), end;
+
+	do {
+		for (size_t i = 0; i < count_board_samples; i += 1) {
+			char fen[MAX_FEN_LENGTH];
+			bool white_to_move, ok;
+
+			write_fen(fen, board_samples[i], i & 1, 0, 1);
+			sum += parse_fen(fen, &white_to_move, &ok).x;
+		}
+
+		positions += count_board_samples;
+		end = wall_seconds();
+	}
+	while (end - start < seconds);
+
+	if (sum == 42) printf(" ");
+	return positions / (end - start);
+}
+
+
+// returns the number of perft nodes per second over all benchmark positions, on plain boards, on
+// boards that carry their attack and pin state (see tracked.h), or with pseudo-legal moves (see
+// pseudo.h)
+
+enum perft_mode { PERFT_PLAIN, PERFT_TRACKED, PERFT_PSEUDO };
+
+double bench_perft(enum perft_mode mode)
+{
+	size_t nodes = 0;
+	double start = wall_seconds();
+
+	for (size_t i = 0; i < count_bench_positions; i += 1) {
+		bool white_to_move, ok;
+		board board = parse_fen(bench_positions[i].FEN, &white_to_move, &ok);
+		unsigned depth = bench_positions[i].depth;
+
+		if (mode == PERFT_TRACKED) {
+			tracked_board pos;
+			init_tracked_board(&pos, board, white_to_move);
+			nodes += tracked_perft(&pos, depth);
+		}
+
+		else if (mode == PERFT_PSEUDO) nodes += pseudo_perft(board, depth);
+		else nodes += perft(board, depth);
+	}
+
+	return nodes / (wall_seconds() - start);
+}
+
+
+//  A search-like workload: every node generates all of its moves (as a search does to order them)
+//  but only the first few are made, as most nodes of a search with good move ordering cut off
+//  early. Unlike perft, moves are generated at every node and there is no bulk counting.
+
+#define SEARCH_WIDTH 3
+#define SEARCH_DEPTH 10
+
+size_t search_nodes(board pos, unsigned depth)
+{
+	movebuffer moves = generate_moves(pos);
+	size_t nodes = 1;
+
+	for (size_t i = 0; depth && i < moves.count && i < SEARCH_WIDTH; i += 1)
+		nodes += search_nodes(make_move(pos, moves.buffer[i]), depth - 1);
+
+	return nodes;
+}
+
+
+size_t tracked_search_nodes(const tracked_board *pos, unsigned depth)
+{
+	movebuffer moves = generate_tracked_moves(pos);
+	size_t nodes = 1;
+	tracked_board child;
+
+	for (size_t i = 0; depth && i < moves.count && i < SEARCH_WIDTH; i += 1) {
+		make_tracked_move(&child, pos, moves.buffer[i]);
+		nodes += tracked_search_nodes(&child, depth - 1);
+	}
+
+	return nodes;
+}
+
+
+// returns the number of nodes per second of the search-like workload over all benchmark positions
+
+double bench_search(bool tracked)
+{
+	size_t nodes = 0;
+	double start = wall_seconds();
+
+	for (size_t i = 0; i < count_bench_positions; i += 1) {
+		bool white_to_move, ok;
+		board board = parse_fen(bench_positions[i].FEN, &white_to_move, &ok);
+
+		if (tracked) {
+			tracked_board pos;
+			init_tracked_board(&pos, board, white_to_move);
+			nodes += tracked_search_nodes(&pos, SEARCH_DEPTH);
+		}
+
+		else nodes += search_nodes(board, SEARCH_DEPTH);
+	}
+
+	return nodes / (wall_seconds() - start);
+}
+
+
+// returns the number of nodes per second of the alpha-beta search over all benchmark positions
+
+double bench_alphabeta(enum alphabeta_mode mode)
+{
+	size_t nodes = 0;
+	double start = wall_seconds();
+
+	for (size_t i = 0; i < count_bench_positions; i += 1)
+		alphabeta(bench_board(i), ALPHABETA_DEPTH, -MATE_SCORE, MATE_SCORE, mode, &nodes);
+
+	return nodes / (wall_seconds() - start);
+}
+
+
+//  The cache-thrashing workload, standing in for the hash table of an engine: random reads and
+//  writes all over a buffer much larger than the caches, until it is killed.
+
+void thrash_caches(size_t megabytes)
+{
+	size_t count = (megabytes << 20) / sizeof(uint64_t);
+	uint64_t *buffer = calloc(count, sizeof *buffer), state = 1;
+
+	for (;;) buffer[splitmix64(&state) % count] += state;
+}
+
+
+#define BENCHMARKS 12
+const char *benchmark_names[BENCHMARKS] = { "slider lookups", "count moves", "count moves batch", "fen write+parse",
+                                            "perft", "perft tracked", "perft pseudo-legal", "search", "search tracked",
+                                            "alpha-beta", "alpha-beta staged", "alpha-beta pseudo" };
+const char *benchmark_units[BENCHMARKS] = { "M lookups/s", "M positions/s", "M positions/s", "M positions/s",
+                                            "M nodes/s", "M nodes/s", "M nodes/s", "M nodes/s", "M nodes/s",
+                                            "M nodes/s", "M nodes/s", "M nodes/s" };
+
+void run_benchmarks(double *results)
+{
+	results[0]  = bench_slider_lookups(1.0) / 1e6;
+	results[1]  = bench_count_moves(1.0, false) / 1e6;
+	results[2]  = bench_count_moves(1.0, true) / 1e6;
+	results[3]  = bench_fen(1.0) / 1e6;
+	results[4]  = bench_perft(PERFT_PLAIN) / 1e6;
+	results[5]  = bench_perft(PERFT_TRACKED) / 1e6;
+	results[6]  = bench_perft(PERFT_PSEUDO) / 1e6;
+	results[7]  = bench_search(false) / 1e6;
+	results[8]  = bench_search(true) / 1e6;
+	results[9]  = bench_alphabeta(MOVES_FULL) / 1e6;
+	results[10] = bench_alphabeta(MOVES_STAGED) / 1e6;
+	results[11] = bench_alphabeta(MOVES_PSEUDO) / 1e6;
+}
+
+
+//  usage: bench [-p processes] [-x megabytes] [-s pext|magic]
+//    -p  number of processes to run the benchmarks in at the same time (default 1)
+//    -x  run a cache-thrashing process over a buffer of this size alongside the benchmarks
+//    -s  slider backend, for builds without BMI2 (by default the one picked for this CPU)
+
+int main(int argc, char **argv)
+{
+	unsigned processes = 1;
+	size_t thrash_megabytes = 0;
+
+	for (int opt; (opt = getopt(argc, argv, "p:x:s:")) != -1;) {
+		switch (opt) {
+			case 'p': processes = strtoul(optarg, NULL, 10); break;
+			case 'x': thrash_megabytes = strtoull(optarg, NULL, 10); break;
+#ifndef __BMI2__
+			case 's': slider_backend = (optarg[0] == 'm') ? SLIDERS_MAGIC : SLIDERS_PEXT; break;
+#endif
+			default : fprintf(stderr, "usage: %s [-p processes] [-x megabytes] [-s pext|magic]\n", argv[0]); return 1;
+		}
+	}
+
+	if (processes == 0) processes = 1;
+
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	collect_corpus();
+
+#ifdef COMPACT_BITBASE
+	printf("slider tables: compact, 16 bit pdep entries (%zu KB)\n", sizeof sliding_attacks >> 10);
+#else
+	printf("slider tables: full, 64 bit entries (%zu KB)\n", sizeof sliding_attacks >> 10);
+#endif
+#ifndef __BMI2__
+	printf("slider backend: %s (runtime dispatch)\n", (slider_backend == SLIDERS_MAGIC) ? "magic" : "pext");
+#endif
+#ifdef KOGGE_STONE_SLIDERS
+	printf("enemy attacks and pins: kogge-stone fills (AVX-512)\n");
+#else
+	printf("enemy attacks and pins: slider tables\n");
+#endif
+	printf("batch lanes: %d\n", BATCH_LANES);
+	printf("cache thrashing: %zu MB\n", thrash_megabytes);
+	printf("processes: %u\n\n", processes);
+
+	// Every process writes its results into shared memory. They all wait on a pipe until every
+	// process has been forked, so that they run the benchmarks at the same time.
+
+	double *results = mmap(NULL, processes * BENCHMARKS * sizeof(double), PROT_READ | PROT_WRITE,
+	                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	int start[2];
+	if (pipe(start) != 0) return 1;
+	fflush(stdout);
+
+	pid_t thrasher = thrash_megabytes ? fork() : -1;
+
+	if (thrasher == 0) {
+		char c;
+		close(start[1]);
+		if (read(start[0], &c, 1) < 0) _exit(1);
+
+		thrash_caches(thrash_megabytes);
+	}
+
+	for (unsigned p = 0; p < processes; p += 1) {
+		if (fork() == 0) {
+			char c;
+			close(start[1]);
+			if (read(start[0], &c, 1) < 0) _exit(1);
+
+			// Rewrite the tables, so that each process has its own copy, as separate engine
+			// processes would, rather than sharing the pages of the parent.
+			init_bitbase_tables();
+			run_benchmarks(results + p * BENCHMARKS);
+			_exit(0);
+		}
+	}
+
+	close(start[0]);
+	close(start[1]);
+
+	// the thrashing process runs until every benchmark process is done
+	unsigned done = 0;
+	for (pid_t pid; done < processes && (pid = wait(NULL)) > 0;) done += (pid != thrasher);
+
+	if (thrasher > 0) kill(thrasher, SIGKILL), waitpid(thrasher, NULL, 0);
+
+	printf("benchmark               per process       total\n");
+	printf("====================================================\n");
+
+	for (unsigned b = 0; b < BENCHMARKS; b += 1) {
+		double total = 0;
+
+		for (unsigned p = 0; p < processes; p += 1)
+			total += results[p * BENCHMARKS + b];
+
+		printf("%-20s %11.1f %11.1f   %s\n", benchmark_names[b], total / processes, total, benchmark_units[b]);
+	}
+}
@@ -6,27 +6,187 @@
 // about 1MB of storage, which can fit into the larger caches of newer CPUs. This can be reducded to
 // about 210kb if using pdep masks, which could be more cache-efficient for a larger project such as a
 // chess engine.
+//
+// Compiling with -DCOMPACT_BITBASE selects the smaller layout: every entry only stores the attacked
+// squares compressed (pext) into 16 bits, relative to the rays of the piece on an empty board. A
+// lookup then needs an extra pdep to expand the entry back into a bitboard.
 
 #define MAGIC_BITBASE_SIZE 107648
-typedef struct { bitboard mask, *attacks; } magic;
+
+#if defined(COMPACT_BITBASE) && !defined(__BMI2__)
+#error COMPACT_BITBASE requires BMI2 to expand the compressed table entries
+#endif
+
+#if defined(PRECOMPUTED_BITBASE) && !defined(__BMI2__)
+#error PRECOMPUTED_BITBASE requires BMI2, without it the table layout is only chosen at runtime
+#endif
+
+#ifdef COMPACT_BITBASE
+typedef uint16_t slider_entry;
+typedef struct { bitboard mask, rays; const slider_entry *attacks; } magic;
+#elif defined(__BMI2__)
+typedef bitboard slider_entry;
+typedef struct { bitboard mask; const slider_entry *attacks; } magic;
+#else
+typedef bitboard slider_entry;
+typedef struct { bitboard mask, multiplier; const slider_entry *attacks; unsigned shift; } magic;
+#endif
+
+// Compiling with -DPRECOMPUTED_BITBASE uses the tables generated ahead of time by gentables.c (run
+// `make bitbase_tables.h` first) as const data instead. There is nothing left to initialise at
+// startup, and the tables are read-only pages shared by every process running the same binary.
+
+#ifdef PRECOMPUTED_BITBASE
+#include "bitbase_tables.h"
+#else
 
 bitboard knight_attacks[64];
 bitboard   king_attacks[64];
 
 bitboard line_between[64][64];
-bitboard sliding_attacks[MAGIC_BITBASE_SIZE];
+slider_entry sliding_attacks[MAGIC_BITBASE_SIZE];
 
 magic bishop_magics[64];
 magic rook_magics[64];
 
+#endif
+
+
+//  Without BMI2 at compile time, the index into the tables is computed by the backend that is fastest
+//  on the CPU we are actually running on, as chosen by init_bitbase_tables():
+//
+//    pext:   the same as BMI2 builds. The instruction is emitted with inline assembly, as the
+//            intrinsic can't be used (or inlined) in code compiled for CPUs without BMI2.
+//    magic:  multiply-shift "fancy" magic bitboards, the index is the top bits of the product of the
+//            masked occupancy and a magic number. The magics below were found by a random search
+//            for multipliers that give the same table sizes as pext, so the layout is unchanged
+//            apart from the order of the entries. This is used on CPUs without BMI2, and on AMD
+//            CPUs before Zen 3, which implement pext in microcode that is slower than a multiply.
+//
+//  The backend never changes after initialisation, so the branch between them is well predicted.
+
+#ifndef __BMI2__
+
+enum slider_backend { SLIDERS_AUTO, SLIDERS_PEXT, SLIDERS_MAGIC };
+enum slider_backend slider_backend; // may be set before init_bitbase_tables() to force a backend
+
+const bitboard bishop_magic_numbers[64] = {
+	0x0920011122108201, 0x0004d01081010000, 0x0042008200800000, 0x0a08061040000041,
+	0x8101104010004008, 0x0002080288008800, 0x4003940120120000, 0x0040120110080403,
+	0x0070081044180052, 0x4800210401204100, 0x00225004820c5800, 0x0100082040410405,
+	0x0080084840008400, 0x0820020211050100, 0x0100004c02201082, 0x0000020500884480,
+	0x2040200882044401, 0x80a010104200a105, 0x4022006404140208, 0x6002000c02120522,
+	0x0002854400a02a40, 0x024200410100d200, 0xa208800400884800, 0x301d30010092100c,
+	0x0002408421440400, 0x001004564808a083, 0x0228180021004500, 0x004004800400a080,
+	0x580101400c004040, 0x100c8200b4221000, 0x9001090084040100, 0x0000828002026422,
+	0x0004024201087000, 0x1801412000981800, 0x069084010470004c, 0x9812020080080080,
+	0x0010008220020200, 0x0000900100408080, 0x02a40102000400a0, 0x1018120049488040,
+	0x1048141008028505, 0x000048080520c808, 0x001302c12a001000, 0x42228a4208040c80,
+	0x0400400102108102, 0x8040080800451020, 0x0050902083040480, 0x0808020080220a10,
+	0x0009241002288100, 0x0800420811084000, 0x8010011841100a40, 0x0028000042088006,
+	0x0040101002121400, 0x8884204501120420, 0x8012200835004800, 0x4004010404088a03,
+	0x5080210120904008, 0x00d042010c490401, 0x00a0002084088880, 0x6000102000840421,
+	0x200d008010021a04, 0x0020806002328208, 0x01c0042108022080, 0x0410100158042041,
+};
+
+const bitboard rook_magic_numbers[64] = {
+	0x0280012010c00a80, 0x2140100040002009, 0x2080200080100008, 0x4100081000200700,
+	0x0200040200201009, 0x0900010008040002, 0x0400011090380204, 0x0200002410804502,
+	0x0310800040089025, 0x0100400020005000, 0x8021001049002000, 0x8001002100100008,
+	0x0102800400080080, 0x000a00082e00104d, 0x0004001842011084, 0x1005000100007082,
+	0x0080208000400084, 0xb000808020004000, 0x0302110045002000, 0x4000848010010800,
+	0x0022020010200408, 0x3501010008040002, 0x000004004810a102, 0x10000200005100a4,
+	0x0510800080204000, 0x0040400080200080, 0x2000110100200040, 0x0080900480080080,
+	0x0001011100080004, 0x044c008080020004, 0x00a021040050a208, 0x0800802180015100,
+	0x180040008180022f, 0x0400400080802000, 0x0240450011002000, 0x8010100080800800,
+	0x1000800400800800, 0x0000020080800400, 0x0040880144000230, 0x004100008f002142,
+	0x0000400080088020, 0x0010002000444000, 0x0420001000208080, 0x520010010021000a,
+	0x0008000500090010, 0x0002005008a20004, 0x2800821088040001, 0x0840208041020004,
+	0x8011244009800180, 0x0045048026004200, 0x004a002840108600, 0x002a4022000a1200,
+	0x0020080004008080, 0x4401044020100801, 0x004221b008020400, 0x2400364100840200,
+	0x00010229128000c1, 0x0009002010820042, 0x004a200040102903, 0x0c04090004100021,
+	0x4041000208000411, 0x080a000408108102, 0x0800081001020084, 0x6000089025040042,
+};
+
+
+bitboard pext_asm(bitboard occ, bitboard mask)
+{
+	bitboard index;
+	__asm__ ("pextq %2, %1, %0" : "=r" (index) : "r" (occ), "r" (mask));
+	return index;
+}
+
+
+size_t slider_index(magic m, bitboard occ)
+{
+	if (slider_backend == SLIDERS_PEXT) return pext_asm(occ, m.mask);
+	return ((occ & m.mask) * m.multiplier) >> m.shift;
+}
+
+
+//  Pick the slider backend for this CPU. Note: AMD family 19h is Zen 3, the first with pext in
+//  hardware. Hygon CPUs (family 18h) are based on Zen 1, with the same microcoded pext.
+
+#include <cpuid.h>
+
+enum slider_backend detect_slider_backend()
+{
+	unsigned eax, ebx, ecx, edx;
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_BMI2))
+		return SLIDERS_MAGIC;
+
+	__get_cpuid(0, &eax, &ebx, &ecx, &edx);
+	bool amd   = (ebx == 0x68747541); // "Auth" of "AuthenticAMD"
+	bool hygon = (ebx == 0x6f677948); // "Hygo" of "HygonGenuine"
+
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+	unsigned family = ((eax >> 8) & 0xf) + ((eax >> 20) & 0xff);
+
+	return ((amd && family < 0x19) || hygon) ? SLIDERS_MAGIC : SLIDERS_PEXT;
+}
+
+#else
+
+size_t slider_index(magic m, bitboard occ) {
+	return pext(occ, m.mask);
+}
+
+#endif
+
+
+#ifdef COMPACT_BITBASE
+
+slider_entry compress_attacks(bitboard attacks, magic m) {
+	return pext(attacks, m.rays);
+}
+
+
+bitboard expand_attacks(slider_entry entry, magic m) {
+	return pdep(entry, m.rays);
+}
+
+#else
+
+slider_entry compress_attacks(bitboard attacks, magic m) {
+	(void) m; return attacks;
+}
+
+
+bitboard expand_attacks(slider_entry entry, magic m) {
+	(void) m; return entry;
+}
+
+#endif
+
 
 bitboard bishop_attacks(square sq, bitboard occ) {
-	magic m = bishop_magics[sq]; return m.attacks[pext(occ, m.mask)];
+	magic m = bishop_magics[sq]; return expand_attacks(m.attacks[slider_index(m, occ)], m);
 }
 
 
 bitboard rook_attacks(square sq, bitboard occ) {
-	magic m = rook_magics[sq]; return m.attacks[pext(occ, m.mask)];
+	magic m = rook_magics[sq]; return expand_attacks(m.attacks[slider_index(m, occ)], m);
 }
 
 
@@ -74,10 +234,20 @@ bitboard generate_line_between(square a, square b)
 }
 
 
+#ifdef PRECOMPUTED_BITBASE
+
+void init_bitbase_tables() {}
+
+#else
+
 void init_bitbase_tables()
 {
 	int index = 0;
 
+#ifndef __BMI2__
+	if (slider_backend == SLIDERS_AUTO) slider_backend = detect_slider_backend();
+#endif
+
 	for (square sq = 0; sq < 64; sq += 1) {
 		bitboard bit = 1ull << sq;
 
@@ -105,16 +275,28 @@ void init_bitbase_tables()
 			bitboard outer = AFILE | HFILE | RANK1 | RANK8 | bit;
 			bitboard mask = (diag | anti) &~ outer;
 
-			bishop_magics[sq].mask = mask;
-			bishop_magics[sq].attacks = sliding_attacks + index;
+			magic *m = &bishop_magics[sq];
+
+			m->mask = mask;
+			m->attacks = sliding_attacks + index;
+#ifdef COMPACT_BITBASE
+			m->rays = (diag | anti) &~ bit;
+#elif !defined(__BMI2__)
+			m->multiplier = bishop_magic_numbers[sq];
+			m->shift = 64 - popcnt(mask);
+#endif
 			bitboard occ = 0;
 
 			do {
-				sliding_attacks[index++] = generate_sliding_attacks(sq, diag, occ)
-				                         | generate_sliding_attacks(sq, anti, occ);
+				bitboard attacks = generate_sliding_attacks(sq, diag, occ)
+				                 | generate_sliding_attacks(sq, anti, occ);
+
+				sliding_attacks[index + slider_index(*m, occ)] = compress_attacks(attacks, *m);
 				occ = (occ - mask) & mask; // iterate over all subset bitboards of a bitboard
 			}
 			while (occ);
+
+			index += 1 << popcnt(mask);
 		}
 
 		// rook attacks
@@ -130,17 +312,28 @@ void init_bitbase_tables()
 
 			bitboard mask = ((file &~ file_outer) | (rank &~ rank_outer)) &~ bit;
 
-			rook_magics[sq].mask = mask;
-			rook_magics[sq].attacks = sliding_attacks + index;
+			magic *m = &rook_magics[sq];
 
+			m->mask = mask;
+			m->attacks = sliding_attacks + index;
+#ifdef COMPACT_BITBASE
+			m->rays = (file | rank) &~ bit;
+#elif !defined(__BMI2__)
+			m->multiplier = rook_magic_numbers[sq];
+			m->shift = 64 - popcnt(mask);
+#endif
 			bitboard occ = 0;
 
 			do {
-				sliding_attacks[index++] = generate_sliding_attacks(sq, file, occ)
-				                         | generate_sliding_attacks(sq, rank, occ);
+				bitboard attacks = generate_sliding_attacks(sq, file, occ)
+				                 | generate_sliding_attacks(sq, rank, occ);
+
+				sliding_attacks[index + slider_index(*m, occ)] = compress_attacks(attacks, *m);
 				occ = (occ - mask) & mask;
 			}
 			while (occ);
+
+			index += 1 << popcnt(mask);
 		}
 	}
 
@@ -148,3 +341,5 @@ void init_bitbase_tables()
 	for (square a = 0; a < 64; a += 1)
 		for (square b = 0; b < 64; b += 1) line_between[a][b] = generate_line_between(a,b);
 }
+
+#endif
@@ -28,17 +28,24 @@ bitboard bswap(bitboard bb) { return __builtin_bswap64(bb); }
 //  plain C code. Some example uses; ctz to iterate over bitboards, bswap to rotate them for a
 //  color agnostic movegen and pext to hash occupancys to generate sliding moves (magic bitboards).
 
-#ifndef __BMI2__
-#error  BMI2 instrinsics are required for this chess engine.
-#endif
+//  Builds without BMI2 (for example -march=x86-64-v2, to run one binary on any CPU) fall back to
+//  the plain builtins. pext and pdep are then not available here, the sliding attack tables instead
+//  choose a backend at runtime (see bitbase.h).
 
 #include <x86intrin.h>
 
+#define popcnt  __builtin_popcountll
+
+#ifdef __BMI2__
 #define clz      _lzcnt_u64
 #define ctz      _tzcnt_u64
-#define popcnt  __builtin_popcountll
 #define pdep     _pdep_u64
 #define pext     _pext_u64
+#else
+// like lzcnt and tzcnt, these give 64 for an empty bitboard, where the builtins are undefined
+static inline uint64_t clz(uint64_t x) { return x ? __builtin_clzll(x) : 64; }
+static inline uint64_t ctz(uint64_t x) { return x ? __builtin_ctzll(x) : 64; }
+#endif
 
 
 // bit iterator: usage: `for bits(mask) { square index = ctz(mask); ... }`
@@ -39,6 +39,14 @@ bitboard extract(board board, piecetype const piece)
 }
 
 
+// The type of the piece on a square, of either side (NONE if it is empty)
+
+piecetype piece_on(board board, square sq)
+{
+	return (board.x >> sq & 1) | (board.y >> sq & 1) << 1 | (board.z >> sq & 1) << 2;
+}
+
+
 //  Place a piece on a given square of the board. Note: this implementation assumes the square is
 //  empty, so must be cleared if previously occupuied. It also assumes the piece is friendly (white).
 
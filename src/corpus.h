@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "board.h"
+#include "fen.h"
+#include "movegen.h"
+
+//  The fixed corpus of positions that the benchmarks are run over (see bench.c and microbench.c),
+//  so that their results can be compared with each other.
+
+typedef struct { const char *name, *FEN; unsigned depth; } benchposition;
+
+const benchposition bench_positions[] =
+{
+	{ "startpos",          "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",                   5 },
+	{ "kiwipete",          "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",           4 },
+	{ "tricky en-passant", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",                                      6 },
+	{ "tricky castling",   "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq -",              4 },
+	{ "talkchess",         "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ -",                      4 },
+	{ "normal middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - -",       4 },
+};
+
+const size_t count_bench_positions = sizeof bench_positions / sizeof bench_positions[0];
+
+board bench_board(size_t index)
+{
+	bool white_to_move, ok;
+	return parse_fen(bench_positions[index].FEN, &white_to_move, &ok);
+}
+
+
+//  Slider lookups are benchmarked with the squares and occupancies of real sliding pieces, taken
+//  from the positions in the first few plies of the benchmark positions, so that the table entries
+//  accessed follow a realistic distribution. The positions themselves are kept for the other
+//  benchmarks.
+
+#define SLIDER_SAMPLES (1 << 20)
+#define BOARD_SAMPLES  (1 << 16)
+
+typedef struct { bitboard occ; square sq; } slider_sample;
+
+slider_sample *slider_samples;
+size_t count_slider_samples;
+
+board *board_samples;
+size_t count_board_samples;
+
+
+void collect_samples(board pos, unsigned depth, size_t board_limit)
+{
+	bitboard occ = occupied(pos);
+	bitboard sliders = (extract(pos, BISHOP) | extract(pos, ROOK) | extract(pos, QUEEN));
+
+	if (count_board_samples < board_limit)
+		board_samples[count_board_samples++] = pos;
+
+	for bits(sliders) {
+		if (count_slider_samples == SLIDER_SAMPLES) break;
+		slider_samples[count_slider_samples++] = (slider_sample) { occ, ctz(sliders) };
+	}
+
+	if (depth == 0 || (count_board_samples == board_limit && count_slider_samples == SLIDER_SAMPLES)) return;
+	movebuffer moves = generate_moves(pos);
+
+	for (size_t i = 0; i < moves.count; i += 1)
+		collect_samples(make_move(pos, moves.buffer[i]), depth - 1, board_limit);
+
+	for bits(moves.pawn_push)
+		collect_samples(make_pawn_push(pos, ctz(moves.pawn_push)), depth - 1, board_limit);
+}
+
+
+// Collect the samples of every benchmark position, the tables must be initialised first. Each
+// position gets an equal share of the board samples, so that the positions with promotions and
+// en-passant are sampled as well as the wider ones.
+
+void collect_corpus()
+{
+	slider_samples = malloc(SLIDER_SAMPLES * sizeof *slider_samples);
+	board_samples  = malloc(BOARD_SAMPLES  * sizeof *board_samples);
+
+	for (size_t i = 0; i < count_bench_positions; i += 1)
+		collect_samples(bench_board(i), 3, count_board_samples + BOARD_SAMPLES / count_bench_positions);
+}
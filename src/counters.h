@@ -0,0 +1,101 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//  Hardware performance counters of the calling thread, read through perf_event_open. Counters
+//  that are not available (in a VM without a virtual PMU, or with perf_event_paranoid > 2) are
+//  left closed and read as unavailable, so benchmarks still run without them.
+//
+//  There is no generic event for L2 misses, so the L2_RQSTS.MISS event of Intel CPUs (Skylake and
+//  newer) is used as a raw event. Other CPUs report the last level cache misses instead.
+//    (Reference: man 2 perf_event_open)
+
+enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, L2_MISSES, COUNTERS };
+
+const char *counter_names[COUNTERS] = { "cycles", "instr", "br-miss", "L1d-miss", "L2-miss" };
+
+typedef struct { int fd[COUNTERS]; } perf_counters;
+
+
+int open_counter(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof attr);
+
+	attr.size = sizeof attr;
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// the counters may be multiplexed if there are not enough of them, the counts are scaled
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+bool intel_cpu()
+{
+	unsigned eax, ebx, ecx, edx;
+	__asm__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (0), "c" (0));
+	return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e; // "GenuineIntel"
+}
+
+
+perf_counters open_counters()
+{
+	perf_counters counters;
+
+	uint64_t l1d_misses = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+	                    | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+
+	counters.fd[CYCLES]        = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	counters.fd[INSTRUCTIONS]  = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	counters.fd[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	counters.fd[L1D_MISSES]    = open_counter(PERF_TYPE_HW_CACHE, l1d_misses);
+	counters.fd[L2_MISSES]     = intel_cpu() ? open_counter(PERF_TYPE_RAW, 0x3f24)
+	                                         : open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	return counters;
+}
+
+
+void close_counters(perf_counters *counters)
+{
+	for (int i = 0; i < COUNTERS; i += 1)
+		if (counters->fd[i] >= 0) close(counters->fd[i]);
+}
+
+
+void start_counters(perf_counters *counters)
+{
+	for (int i = 0; i < COUNTERS; i += 1) {
+		if (counters->fd[i] < 0) continue;
+		ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+
+// Stop the counters and read them, the count of an unavailable counter is -1
+
+void stop_counters(perf_counters *counters, double *counts)
+{
+	for (int i = 0; i < COUNTERS; i += 1) {
+		uint64_t values[3]; // count, time enabled, time running
+		counts[i] = -1;
+
+		if (counters->fd[i] < 0) continue;
+		ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+		if (read(counters->fd[i], values, sizeof values) == sizeof values && values[2] > 0)
+			counts[i] = (double) values[0] * values[1] / values[2];
+	}
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include "board.h"
+#include "legal.h"
+#include "movegen.h"
+#include "notation.h"
+#include "perft.h"
+
+//  Perft divide, and perft with the standard breakdown of the leaves into captures (including
+//  en-passant), en-passant captures, castles, promotions, checks and checkmates, as given in
+//  (https://www.chessprogramming.org/Perft_Results).
+//
+//  The categories are counted in bulk at the last ply, like the leaf count of perft: from the
+//  destination masks of the move generator, masked with the enemy pieces for captures, and with
+//  the squares from which each piece type attacks the enemy king for direct checks. Discovered
+//  checks come from the pieces standing between one of our sliders and the enemy king, when they
+//  leave that line. Only the moves that are both rare and awkward to mask (castling, promotions
+//  and en-passant) are made and tested one by one, and checkmates need the moves of the position
+//  after each check, so only checking moves are ever made. On a single thread, a statistical perft
+//  measured 0.53 to 0.6 times the speed of a plain one from the start position at depth 6, and 0.39
+//  to 0.4 times for kiwipete at depth 5, most of the difference being the checkmate tests.
+
+typedef struct { size_t nodes, captures, en_passant, castles, promotions, checks, mates; } perft_stats;
+
+typedef struct { move move; size_t nodes; } divide_entry;
+
+// The squares that give check to the enemy king, for the moves of one position
+typedef struct {
+	bitboard direct[8];     // squares from which each piece type attacks the king
+	bitboard discoverers;   // our pieces standing between one of our sliders and the king
+	bitboard lines[64];     // the line each discoverer must stay on to keep blocking (only set for them)
+} check_info;
+
+
+void add_perft_stats(perft_stats *total, perft_stats stats)
+{
+	total->nodes      += stats.nodes;
+	total->captures   += stats.captures;
+	total->en_passant += stats.en_passant;
+	total->castles    += stats.castles;
+	total->promotions += stats.promotions;
+	total->checks     += stats.checks;
+	total->mates      += stats.mates;
+}
+
+
+void generate_check_info(board board, check_info *info)
+{
+	bitboard occ  = occupied(board);
+	bitboard ours = board.white & occ;
+	square king   = ctz(extract(board, KING) & occ &~ board.white);
+	bitboard bit  = 1ull << king;
+
+	bitboard bishop_ray = bishop_attacks(king, occ);
+	bitboard rook_ray   = rook_attacks(king, occ);
+
+	info->direct[PAWN]   = south(east(bit) | west(bit));
+	info->direct[KNIGHT] = knight_attacks[king];
+	info->direct[BISHOP] = bishop_ray;
+	info->direct[ROOK]   = rook_ray;
+	info->direct[QUEEN]  = bishop_ray | rook_ray;
+	info->direct[KING]   = 0;
+
+	// as in generate_pinned, but with our sliders and pieces around the enemy king
+	bitboard queens  = extract(board, QUEEN) & ours;
+	bitboard bishops = (extract(board, BISHOP) & ours) | queens;
+	bitboard rooks   = (extract(board, ROOK)   & ours) | queens;
+
+	bitboard blockers = (bishop_ray | rook_ray) & ours;
+	bitboard nocc = occ &~ blockers;
+
+	bitboard sliders = (bishops & bishop_attacks(king, nocc)) | (rooks & rook_attacks(king, nocc));
+	info->discoverers = 0;
+
+	for bits(sliders) {
+		bitboard line = line_between[king][ctz(sliders)];
+		bitboard blocker = line & blockers;
+
+		info->discoverers |= blocker;
+		info->lines[ctz(blocker)] = line;
+	}
+}
+
+
+// The destinations of a piece from `init` that give check, as the piece it is after the move
+
+bitboard checking_moves(const check_info *info, square init, piecetype piece, bitboard dests)
+{
+	bitboard checks = dests & info->direct[piece];
+
+	if (info->discoverers >> init & 1)
+		checks |= dests &~ info->lines[init];
+
+	return checks;
+}
+
+
+// Whether a position in check is checkmate. Most checks are escaped by a king move, which is looked
+// for before counting the other moves.
+
+void count_mate(perft_stats *stats, board child)
+{
+	bitboard checks;
+	movegen_info info = generate_movegen_info(child, &checks);
+
+	if (king_targets(info, child)) return;
+	if (popcnt(checks) == 2 || count_moves_from_info(info, child, checks) == 0) stats->mates += 1;
+}
+
+
+// A move that is made and tested on its own (castling, promotion or en-passant)
+
+void count_single_move(perft_stats *stats, board pos, move move)
+{
+	board child = make_move(pos, move);
+	bitboard occ = occupied(child);
+	square king = ctz(extract(child, KING) & child.white);
+
+	stats->nodes += 1;
+
+	if (attackers_to(child, king, occ) & occ &~ child.white) {
+		stats->checks += 1;
+		count_mate(stats, child);
+	}
+}
+
+
+void count_pawn_stats(perft_stats *stats, movegen_info info, board board, const check_info *check)
+{
+	pawn_targets pawn = generate_pawn_targets(info, board);
+
+	bitboard pawns = extract(board, PAWN) & board.white;
+	bitboard en_passant = board.white &~ occupied(board);
+
+	// promotions, each of them 4 moves
+	bitboard promotions[3] = { pawn.single_move & RANK8, pawn.east_capture & RANK8, pawn.west_capture & RANK8 };
+	square directions[3] = { N, N+E, N+W };
+
+	for (int i = 0; i < 3; i += 1) {
+		for bits(promotions[i]) {
+			square dest = ctz(promotions[i]), init = dest - directions[i];
+
+			count_single_move(stats, board, M(init, dest, KNIGHT));
+			count_single_move(stats, board, M(init, dest, BISHOP));
+			count_single_move(stats, board, M(init, dest, ROOK));
+			count_single_move(stats, board, M(init, dest, QUEEN));
+
+			stats->promotions += 4;
+			stats->captures += (i > 0) ? 4 : 0;
+		}
+	}
+
+	// en-passant, the captured pawn may uncover a check as well
+	bitboard ep_captures[2] = { pawn.east_capture & en_passant, pawn.west_capture & en_passant };
+
+	for (int i = 0; i < 2; i += 1) {
+		for bits(ep_captures[i]) {
+			square dest = ctz(ep_captures[i]);
+			count_single_move(stats, board, M(dest - directions[i + 1], dest, PAWN));
+			stats->captures += 1, stats->en_passant += 1;
+		}
+	}
+
+	// every other pawn move, by its kind as the direction gives the initial square
+	bitboard moves[4] = {
+		pawn.single_move &~ RANK8,
+		pawn.double_move,
+		pawn.east_capture &~ RANK8 &~ en_passant,
+		pawn.west_capture &~ RANK8 &~ en_passant,
+	};
+
+	square distances[4] = { N, N+N, N+E, N+W };
+	bitboard checks[4];
+
+	for (int i = 0; i < 4; i += 1) {
+		stats->nodes += popcnt(moves[i]);
+		checks[i] = moves[i] & check->direct[PAWN];
+	}
+
+	stats->captures += popcnt(moves[2]) + popcnt(moves[3]);
+
+	bitboard discoverers = check->discoverers & pawns;
+
+	for bits(discoverers) {
+		square init = ctz(discoverers);
+
+		for (int i = 0; i < 4; i += 1)
+			checks[i] |= moves[i] & ((1ull << init) << distances[i]) &~ check->lines[init];
+	}
+
+	for (int i = 0; i < 4; i += 1) {
+		stats->checks += popcnt(checks[i]);
+
+		for bits(checks[i]) {
+			square dest = ctz(checks[i]);
+			count_mate(stats, i < 2 ? make_pawn_push(board, dest) : make_move(board, M(dest - distances[i], dest, PAWN)));
+		}
+	}
+}
+
+
+// Knights, bishops, rooks and queens, pinned or not, one piece at a time
+
+void count_piece_stats(perft_stats *stats, movegen_info info, board board, const check_info *check)
+{
+	bitboard occ    = occupied(board);
+	bitboard enemy  = occ &~ board.white;
+	bitboard pieces = board.white & occ &~ extract(board, PAWN) &~ extract(board, KING);
+
+	for bits(pieces) {
+		square init = ctz(pieces);
+		bitboard bit = 1ull << init;
+		piecetype piece = piece_on(board, init);
+		bitboard dests;
+
+		if (piece == CASTLE) piece = ROOK;
+
+		// pinned pieces move along their pin, as in movable_pieces
+		if (bit & info.vpinned)
+			dests = (piece == BISHOP || piece == QUEEN) ? bishop_attacks(init, occ) & info.vpinned : 0;
+		else if (bit & info.hpinned)
+			dests = (piece == ROOK || piece == QUEEN) ? rook_attacks(init, occ) & info.hpinned : 0;
+		else
+			dests = generic_attacks(piece, init, occ);
+
+		dests &= info.targets;
+
+		bitboard checks = checking_moves(check, init, piece, dests);
+
+		stats->nodes    += popcnt(dests);
+		stats->captures += popcnt(dests & enemy);
+		stats->checks   += popcnt(checks);
+
+		for bits(checks)
+			count_mate(stats, make_move(board, M(init, ctz(checks), piece)));
+	}
+}
+
+
+void count_king_stats(perft_stats *stats, movegen_info info, board board, const check_info *check)
+{
+	bitboard dests  = king_targets(info, board);
+	bitboard checks = checking_moves(check, info.king, KING, dests);
+
+	stats->nodes    += popcnt(dests);
+	stats->captures += popcnt(dests & occupied(board));
+	stats->checks   += popcnt(checks);
+
+	for bits(checks)
+		count_mate(stats, make_move(board, M(info.king, ctz(checks), KING)));
+
+	bitboard castling = legal_castling(info, board);
+	stats->castles += popcnt(castling);
+
+	if (castling & (1 << A1)) count_single_move(stats, board, M(E1, C1, KING) | M_CASTLING);
+	if (castling & (1 << H1)) count_single_move(stats, board, M(E1, G1, KING) | M_CASTLING);
+}
+
+
+// The statistics of the legal moves of a position, the leaves of a perft of depth 1
+
+void count_move_stats(board board, perft_stats *stats)
+{
+	bitboard checks;
+	movegen_info info = generate_movegen_info(board, &checks);
+
+	check_info check;
+	generate_check_info(board, &check);
+
+	if (popcnt(checks) < 2) {
+		count_pawn_stats (stats, info, board, &check);
+		count_piece_stats(stats, info, board, &check);
+	}
+
+	count_king_stats(stats, info, board, &check);
+}
+
+
+void stats_perft(board pos, unsigned depth, perft_stats *stats)
+{
+	if (depth == 1) {
+		count_move_stats(pos, stats);
+		return;
+	}
+
+	movebuffer moves = generate_moves(pos);
+
+	for (size_t i = 0; i < moves.count; i += 1)
+		stats_perft(make_move(pos, moves.buffer[i]), depth - 1, stats);
+
+	for bits(moves.pawn_push)
+		stats_perft(make_pawn_push(pos, ctz(moves.pawn_push)), depth - 1, stats);
+}
+
+
+//  The statistics are split over threads by the pool of parallel_perft. The perft table only holds
+//  leaf counts, so it is not used here.
+
+// Counted locally, as the accumulators of the threads are next to each other in memory
+
+void count_stats_task(void *context, perft_task task, void *stats)
+{
+	perft_stats local = {0};
+	(void) context;
+
+	stats_perft(task.pos, task.depth, &local);
+	add_perft_stats(stats, local);
+}
+
+
+void parallel_stats_perft(board pos, unsigned depth, unsigned threads, perft_stats *stats)
+{
+	if (threads <= 1 || depth < PERFT_MIN_TASK_DEPTH) {
+		stats_perft(pos, depth, stats);
+		return;
+	}
+
+	perft_stats *totals = calloc(threads, sizeof *totals);
+	run_perft_pool(pos, depth, threads, count_stats_task, NULL, totals, sizeof *totals);
+
+	for (unsigned i = 0; i < threads; i += 1)
+		add_perft_stats(stats, totals[i]);
+
+	free(totals);
+}
+
+
+//  Perft divide: the leaf count below each root move, in the order of generate_moves followed by
+//  the pawn pushes. Each subtree is counted with parallel_perft, so the threads and the table are
+//  used as in a plain perft. Returns the number of root moves written to `entries`.
+
+size_t perft_divide(board pos, unsigned depth, unsigned threads, perft_table *table, divide_entry entries[MAX_MOVES])
+{
+	movebuffer moves = generate_moves(pos);
+	size_t count = 0;
+
+	for (size_t i = 0; i < moves.count; i += 1) {
+		board child = make_move(pos, moves.buffer[i]);
+		entries[count++] = (divide_entry) { moves.buffer[i], depth > 1 ? parallel_perft(child, depth - 1, threads, table) : 1 };
+	}
+
+	for bits(moves.pawn_push) {
+		square dest = ctz(moves.pawn_push);
+		board child = make_pawn_push(pos, dest);
+		entries[count++] = (divide_entry) { pawn_push_move(pos, dest), depth > 1 ? parallel_perft(child, depth - 1, threads, table) : 1 };
+	}
+
+	return count;
+}
@@ -0,0 +1,448 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitbase.h"
+#include "epd.h"
+#include "fen.h"
+#include "hash.h"
+#include "perft.h"
+#include "timer.h"
+
+//  Perft runs that are too long to risk in a single process (depth 9 and up from the start). The
+//  tree is enumerated to a split depth once, and the distinct positions at that depth are written
+//  to a units file, each with the number of paths that lead to it (transpositions are counted only
+//  once, which already saves most of the work at a deep enough split). Any number of worker
+//  processes then take units in turn and append their counts to a journal, a text file of lines:
+//
+//    claim  unit
+//    done   unit  nodes
+//
+//  Workers only share the two files, so they may run on any machines that share a filesystem. The
+//  journal is locked (with fcntl, which also works over NFS) while a worker reads the lines added
+//  since it last looked and appends its own, so every worker knows which units are taken. A unit is
+//  given to a worker in order of how few claims it has, so once every unit is claimed, the units
+//  that are still running (or whose worker died) are handed out again. A run is resumed simply by
+//  starting workers on the same journal, and the units that were done are never run again. Counts
+//  are deterministic, so a unit done twice is only wasted time, and the first count is kept.
+
+#define UNITS_MAGIC "PERFTUNT"
+
+typedef struct {
+	char magic[8];
+	uint32_t split, depth;  // the plies to the units, and the depth of the perft of each unit
+	uint64_t count;
+	char fen[MAX_FEN_LENGTH];
+} units_header;
+
+typedef struct { board board; uint64_t paths; } perft_unit;
+
+typedef struct {
+	epd_file file;
+	units_header header;
+	const perft_unit *units;
+} units_file;
+
+
+// The distinct positions at the split depth, deduplicated through an open-addressing table of
+// indices into the list of units
+
+typedef struct {
+	perft_unit *units;
+	size_t count, capacity;
+	uint32_t *slots;        // index + 1 of the unit in each slot, 0 if empty
+	size_t mask;
+} unit_set;
+
+
+void grow_unit_set(unit_set *set)
+{
+	size_t size = (set->mask + 1) * 2;
+
+	free(set->slots);
+	set->slots = calloc(size, sizeof *set->slots);
+	set->mask = size - 1;
+
+	for (size_t i = 0; i < set->count; i += 1) {
+		size_t slot = hash_board(set->units[i].board) & set->mask;
+		while (set->slots[slot]) slot = (slot + 1) & set->mask;
+		set->slots[slot] = i + 1;
+	}
+}
+
+
+void add_unit(unit_set *set, board pos)
+{
+	size_t slot = hash_board(pos) & set->mask;
+
+	for (; set->slots[slot]; slot = (slot + 1) & set->mask) {
+		perft_unit *unit = &set->units[set->slots[slot] - 1];
+
+		if (memcmp(&unit->board, &pos, sizeof pos) == 0) {
+			unit->paths += 1;
+			return;
+		}
+	}
+
+	if (set->count == set->capacity)
+		set->units = realloc(set->units, (set->capacity *= 2) * sizeof *set->units);
+
+	set->units[set->count++] = (perft_unit) { pos, 1 };
+	set->slots[slot] = set->count;
+
+	if (set->count * 2 > set->mask) grow_unit_set(set);
+}
+
+
+void enumerate_units(unit_set *set, board pos, unsigned depth)
+{
+	if (depth == 0) {
+		add_unit(set, pos);
+		return;
+	}
+
+	movebuffer moves = generate_moves(pos);
+
+	for (size_t i = 0; i < moves.count; i += 1)
+		enumerate_units(set, make_move(pos, moves.buffer[i]), depth - 1);
+
+	for bits(moves.pawn_push)
+		enumerate_units(set, make_pawn_push(pos, ctz(moves.pawn_push)), depth - 1);
+}
+
+
+int create_units(const char *path, const char *fen, unsigned split, unsigned depth)
+{
+	bool white_to_move, ok;
+	board root = parse_fen(fen, &white_to_move, &ok);
+
+	if (!ok) {
+		fprintf(stderr, "invalid FEN: %s\n", fen);
+		return 1;
+	}
+
+	if (depth <= split) {
+		fprintf(stderr, "the depth must be greater than the split depth\n");
+		return 1;
+	}
+
+	unit_set set = { malloc(1024 * sizeof *set.units), 0, 1024, calloc(2048, sizeof *set.slots), 2047 };
+	enumerate_units(&set, root, split);
+
+	units_header header = { UNITS_MAGIC, split, depth - split, set.count, "" };
+	write_fen(header.fen, root, white_to_move, 0, 1);
+
+	FILE *out = fopen(path, "wb");
+
+	if (!out) {
+		fprintf(stderr, "could not write %s\n", path);
+		return 1;
+	}
+
+	fwrite(&header, sizeof header, 1, out);
+	fwrite(set.units, sizeof *set.units, set.count, out);
+
+	ok = !ferror(out);
+	ok &= (fclose(out) == 0);
+
+	uint64_t paths = 0;
+	for (size_t i = 0; i < set.count; i += 1) paths += set.units[i].paths;
+
+	fprintf(stderr, "%zu units (%" PRIu64 " positions at depth %u), perft %u of each\n", set.count, paths, split, depth - split);
+
+	free(set.units);
+	free(set.slots);
+	return ok ? 0 : 1;
+}
+
+
+bool open_units_file(const char *path, units_file *units)
+{
+	if (!open_epd_file(path, &units->file)) return false;
+
+	if (units->file.size < sizeof units->header) goto invalid;
+	memcpy(&units->header, units->file.data, sizeof units->header);
+
+	if (memcmp(units->header.magic, UNITS_MAGIC, 8) != 0
+	 || units->file.size != sizeof units->header + units->header.count * sizeof (perft_unit))
+		goto invalid;
+
+	units->units = (const perft_unit *) (units->file.data + sizeof units->header);
+	return true;
+
+invalid:
+	close_epd_file(&units->file);
+	return false;
+}
+
+
+//  The state of the journal as this process has read it. `read` is the offset up to which lines
+//  have been read. A line without its newline at the end of the file can only be left by a writer
+//  that died, and it is made invalid (whatever it was cut off at) before the next line is appended.
+
+typedef struct {
+	int fd;
+	off_t read;
+	bool partial;
+	size_t count, done, next;   // units, units done, and the first unit that may be unclaimed
+	uint32_t *claims;
+	uint64_t *nodes;            // the count of each unit plus one, 0 if not done
+} journal;
+
+
+bool lock_journal(journal *log, short type)
+{
+	struct flock lock = { .l_type = type, .l_whence = SEEK_SET };
+	return fcntl(log->fd, F_SETLKW, &lock) == 0;
+}
+
+
+void parse_journal_line(journal *log, const char *line)
+{
+	char *end;
+	uint64_t unit, nodes;
+
+	if (strncmp(line, "claim ", 6) == 0) {
+		unit = strtoull(line + 6, &end, 10);
+		if (*end == '\n' && unit < log->count) log->claims[unit] += 1;
+	}
+
+	else if (strncmp(line, "done ", 5) == 0) {
+		unit = strtoull(line + 5, &end, 10);
+		nodes = strtoull(end, &end, 10);
+
+		if (*end == '\n' && unit < log->count && !log->nodes[unit]) {
+			log->nodes[unit] = nodes + 1;
+			log->done += 1;
+		}
+	}
+}
+
+
+// Read the lines appended since the last read, the journal must be locked
+
+bool read_journal(journal *log)
+{
+	char buffer[1 << 16];
+	size_t kept = 0;
+
+	for (;;) {
+		ssize_t n = pread(log->fd, buffer + kept, sizeof buffer - kept - 1, log->read + kept);
+		if (n < 0) return false;
+
+		size_t length = kept + n;
+		char *line = buffer, *newline;
+
+		while ((newline = memchr(line, '\n', buffer + length - line))) {
+			parse_journal_line(log, line);
+			line = newline + 1;
+		}
+
+		log->read += line - buffer;
+		kept = buffer + length - line;
+		memmove(buffer, line, kept);
+
+		if (n == 0) break;
+
+		// a line that doesn't fit in the buffer is garbage
+		if (kept == sizeof buffer - 1) log->read += kept, kept = 0;
+	}
+
+	log->partial = kept > 0;
+	return true;
+}
+
+
+bool append_journal(journal *log, const char *line)
+{
+	char buffer[64];
+	int length = snprintf(buffer, sizeof buffer, "%s%s", log->partial ? " torn\n" : "", line);
+
+	log->partial = false;
+	return write(log->fd, buffer, length) == length;
+}
+
+
+bool open_journal(const char *path, journal *log, size_t count)
+{
+	log->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (log->fd < 0) return false;
+
+	log->read = 0, log->partial = false;
+	log->count = count, log->done = 0, log->next = 0;
+	log->claims = calloc(count, sizeof *log->claims);
+	log->nodes = calloc(count, sizeof *log->nodes);
+
+	return true;
+}
+
+
+void close_journal(journal *log)
+{
+	close(log->fd);
+	free(log->claims);
+	free(log->nodes);
+}
+
+
+// The unit with the fewest claims that isn't done, SIZE_MAX if all units are done
+
+size_t choose_unit(journal *log)
+{
+	while (log->next < log->count && (log->claims[log->next] || log->nodes[log->next]))
+		log->next += 1;
+
+	if (log->next < log->count) return log->next;
+
+	size_t best = SIZE_MAX;
+
+	for (size_t i = 0; i < log->count; i += 1)
+		if (!log->nodes[i] && (best == SIZE_MAX || log->claims[i] < log->claims[best])) best = i;
+
+	return best;
+}
+
+
+// Claim a unit and run it, returns false once there is nothing left to do
+
+bool run_unit(journal *log, const units_file *units, unsigned threads, perft_table *table, bool *failed)
+{
+	char line[64];
+
+	if (!lock_journal(log, F_WRLCK) || !read_journal(log)) goto error;
+
+	size_t unit = choose_unit(log);
+	bool ok = true;
+
+	if (unit != SIZE_MAX) {
+		snprintf(line, sizeof line, "claim %zu\n", unit);
+		ok = append_journal(log, line);
+	}
+
+	lock_journal(log, F_UNLCK);
+
+	if (!ok) goto error;
+	if (unit == SIZE_MAX) return false;
+
+	double t1 = wall_seconds();
+	size_t nodes = parallel_perft(units->units[unit].board, units->header.depth, threads, table);
+	double t2 = wall_seconds();
+
+	snprintf(line, sizeof line, "done %zu %zu\n", unit, nodes);
+
+	if (!lock_journal(log, F_WRLCK) || !read_journal(log)) goto error;
+	ok = append_journal(log, line) && fdatasync(log->fd) == 0;
+	lock_journal(log, F_UNLCK);
+
+	if (!ok) goto error;
+
+	printf("%zu\t%zu\t%.3f\n", unit, nodes, t2 - t1);
+	fflush(stdout);
+	return true;
+
+error:
+	perror("journal");
+	*failed = true;
+	return false;
+}
+
+
+// The total so far, returns whether the perft is complete
+
+bool report(const journal *log, const units_file *units)
+{
+	uint64_t total = 0, paths = 0, done = 0;
+
+	for (size_t i = 0; i < log->count; i += 1) {
+		paths += units->units[i].paths;
+
+		if (log->nodes[i]) {
+			total += units->units[i].paths * (log->nodes[i] - 1);
+			done += units->units[i].paths;
+		}
+	}
+
+	unsigned depth = units->header.split + units->header.depth;
+
+	if (log->done == log->count) {
+		printf("perft %u of %s: %" PRIu64 "\n", depth, units->header.fen, total);
+		return true;
+	}
+
+	printf("perft %u of %s: %zu of %zu units done (%.2f%% of the paths), %" PRIu64 " nodes so far\n",
+	       depth, units->header.fen, log->done, log->count, 100.0 * done / paths, total);
+	return false;
+}
+
+
+//  usage: dperft -s split -d depth [-f fen] units          write the units of a perft to a file
+//         dperft [-t threads] [-H megabytes] units journal   run units until all are done
+//         dperft -r units journal                            print the result, or the progress so far
+//
+//  A worker writes a line per unit it runs (unit, nodes, seconds), and the result once every unit is
+//  done. The report exits with status 0 only if the perft is complete.
+
+int main(int argc, char **argv)
+{
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	const char *fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+	unsigned split = 0, depth = 0, threads = 1;
+	size_t megabytes = 0;
+	bool only_report = false;
+
+	for (int opt; (opt = getopt(argc, argv, "s:d:f:t:H:r")) != -1;) {
+		switch (opt) {
+			case 's': split = strtoul(optarg, NULL, 10); break;
+			case 'd': depth = strtoul(optarg, NULL, 10); break;
+			case 'f': fen = optarg; break;
+			case 't': threads = strtoul(optarg, NULL, 10); break;
+			case 'H': megabytes = strtoull(optarg, NULL, 10); break;
+			case 'r': only_report = true; break;
+			default : goto usage;
+		}
+	}
+
+	if (depth && optind + 1 == argc) return create_units(argv[optind], fen, split, depth);
+	if (depth || optind + 2 != argc) goto usage;
+
+	units_file units;
+	journal log;
+
+	if (!open_units_file(argv[optind], &units)) {
+		fprintf(stderr, "could not read units from %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (!open_journal(argv[optind + 1], &log, units.header.count)) {
+		fprintf(stderr, "could not open %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	bool failed = false;
+
+	if (!only_report) {
+		perft_table storage, *table = NULL;
+		if (megabytes) storage = create_perft_table(megabytes), table = &storage;
+
+		while (run_unit(&log, &units, threads ? threads : 1, table, &failed));
+		if (table) free_perft_table(table);
+	}
+
+	if (!failed && lock_journal(&log, F_RDLCK) && read_journal(&log)) {
+		lock_journal(&log, F_UNLCK);
+		failed = !report(&log, &units);
+	}
+
+	close_journal(&log);
+	close_epd_file(&units.file);
+	return failed ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s -s split -d depth [-f fen] units | [-t threads] [-H megabytes] units journal | -r units journal\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fen.h"
+
+//  Streaming reader for files of FEN or EPD records, one per line. The file is mapped into memory
+//  rather than read through a buffer, so the parser works directly on the page cache and lines
+//  never need to be copied. A file can be split into any number of parts at line boundaries, so
+//  that each thread reads its own part of the same mapping.
+//    (Reference: https://www.chessprogramming.org/Extended_Position_Description)
+
+typedef struct { const char *data; size_t size; } epd_file;
+
+// A part of a file, records are read from `next` up to `end`
+typedef struct { const char *next, *end; } epd_reader;
+
+//  A record read from a file. `operations` points to whatever follows the FEN fields on the line
+//  (EPD operations such as "bm e4; id ..." or perft counts), and is `operations_length` long.
+
+typedef struct {
+	board board;
+	bool white_to_move;
+	unsigned halfmove, fullmove;
+	const char *line, *operations;
+	size_t line_length, operations_length;
+} epd_record;
+
+
+bool open_epd_file(const char *path, epd_file *file)
+{
+	struct stat info;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return false;
+
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+
+	file->size = info.st_size;
+	file->data = NULL;
+
+	if (file->size) {
+		void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) data = NULL;
+
+		file->data = data;
+		if (data) madvise(data, file->size, MADV_SEQUENTIAL);
+	}
+
+	close(fd); // the mapping keeps the file open
+	return file->size == 0 || file->data != NULL;
+}
+
+
+void close_epd_file(epd_file *file)
+{
+	if (file->data) munmap((void *) file->data, file->size);
+	file->data = NULL, file->size = 0;
+}
+
+
+//  Split a file into `parts` parts of roughly equal size, and return a reader for one of them. Each
+//  part starts at the first line that starts at or after its share of the file, so every line is in
+//  exactly one part (a part may be empty if lines are longer than the parts).
+
+const char *epd_line_start(epd_file file, size_t offset)
+{
+	if (offset == 0) return file.data;
+	if (offset >= file.size) return file.data + file.size;
+
+	const char *newline = memchr(file.data + offset - 1, '\n', file.size - offset + 1);
+	return newline ? newline + 1 : file.data + file.size;
+}
+
+
+epd_reader epd_file_part(epd_file file, unsigned part, unsigned parts)
+{
+	size_t begin = file.size / parts * part;
+	size_t end   = (part + 1 == parts) ? file.size : file.size / parts * (part + 1);
+
+	return (epd_reader) { epd_line_start(file, begin), epd_line_start(file, end) };
+}
+
+
+//  Read the next record, skipping empty lines and comments (lines starting with '#'). Returns false
+//  at the end of the part. `ok` is cleared if the line could not be parsed, the record still holds
+//  the line so that it can be reported.
+//
+//  The parser stops at the first character that can't be part of a field, so it never reads past
+//  the end of the line. The only exception is the last line of a file without a final newline, as
+//  the mapping is not null-terminated, which is copied out first.
+
+#define MAX_EPD_LINE 1024
+
+bool read_epd(epd_reader *reader, epd_record *record, bool *ok)
+{
+	const char *line, *newline;
+
+	do {
+		if (reader->next >= reader->end) return false;
+
+		line = reader->next;
+		newline = memchr(line, '\n', reader->end - line);
+		reader->next = newline ? newline + 1 : reader->end;
+	}
+	while (line[0] == '\n' || line[0] == '\r' || line[0] == '#');
+
+	size_t length = (newline ? newline : reader->end) - line;
+	if (length && line[length - 1] == '\r') length -= 1;
+
+	record->line = line;
+	record->line_length = length;
+
+	const char *fen = line;
+	char last_line[MAX_EPD_LINE];
+
+	if (!newline) {
+		if (length >= MAX_EPD_LINE) length = MAX_EPD_LINE - 1;
+		memcpy(last_line, line, length);
+		last_line[length] = '\0';
+		fen = last_line;
+	}
+
+	const char *end = parse_fen_fields(fen, &record->board, &record->white_to_move, &record->halfmove, &record->fullmove);
+	*ok = (end != NULL);
+
+	if (!end) end = fen + length;
+	while (end < fen + length && *end == ' ') end += 1;
+
+	record->operations = line + (end - fen);
+	record->operations_length = length - (end - fen);
+	return true;
+}
@@ -1,75 +1,99 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "board.h"
 
-/// TODO: this file is in need of cleaning up. It is just a basic implementation that works for now.
-//  This parser will be integrated with other parsers, such as moves and UCI options.
+//  Reading and writing of positions in Forsyth-Edwards Notation. Both are used in bulk (for test
+//  suites and training data, see epd.h), so they avoid branching on the contents where possible.
 
 
-const piecetype piece_lookup[128] = {
-	['p'] = PAWN,
-	['n'] = KNIGHT,
-	['b'] = BISHOP,
-	['r'] = ROOK,
-	['q'] = QUEEN,
-	['k'] = KING,
+//  Each character of the board field is looked up in a table: bits 0-2 hold the piecetype, bit 3 is
+//  set for black pieces, bits 4-7 hold the number of squares to advance (1 for a piece, n for a digit)
+//  and bit 8 marks a rank separator. Any other character is 0. The codes are stored per square while
+//  parsing, and only gathered into the bitboards at the end, 16 squares at a time, so that placing a
+//  piece is a single store rather than a branch on each of its bits.
+
+#define FEN_BLACK  0x008
+#define FEN_STEP   0x010
+#define FEN_RANK   0x100
+
+const uint16_t fen_board_chars[128] = {
+	['P'] = PAWN   | FEN_STEP,  ['p'] = PAWN   | FEN_STEP | FEN_BLACK,
+	['N'] = KNIGHT | FEN_STEP,  ['n'] = KNIGHT | FEN_STEP | FEN_BLACK,
+	['B'] = BISHOP | FEN_STEP,  ['b'] = BISHOP | FEN_STEP | FEN_BLACK,
+	['R'] = ROOK   | FEN_STEP,  ['r'] = ROOK   | FEN_STEP | FEN_BLACK,
+	['Q'] = QUEEN  | FEN_STEP,  ['q'] = QUEEN  | FEN_STEP | FEN_BLACK,
+	['K'] = KING   | FEN_STEP,  ['k'] = KING   | FEN_STEP | FEN_BLACK,
+
+	['1'] = 1 * FEN_STEP, ['2'] = 2 * FEN_STEP, ['3'] = 3 * FEN_STEP, ['4'] = 4 * FEN_STEP,
+	['5'] = 5 * FEN_STEP, ['6'] = 6 * FEN_STEP, ['7'] = 7 * FEN_STEP, ['8'] = 8 * FEN_STEP,
+
+	['/'] = FEN_RANK,
 };
 
 
-// Parse Forsyth-Edwards Notation for a legal chess position.
+// Parse Forsyth-Edwards Notation for a legal chess position, including the halfmove clock and
+// fullmove number. These last two fields are optional (EPD records and many test suites leave them
+// out), and default to 0 and 1 respectively. Returns a pointer to the character after the last
+// field parsed (for EPD, the start of the operations), or NULL if the FEN is invalid.
 //   (Reference: https://www.chessprogramming.org/Forsyth-Edwards_Notation)
 
-board parse_fen(const char *fen_string, bool *white_to_move, bool *ok)
+const char *parse_fen_fields(const char *fen_string, board *result, bool *white_to_move, unsigned *halfmove, unsigned *fullmove)
 {
 	board board = {0};
-	square sq = 56, file = 0;
+	// padded as an overlong last rank is only rejected after its square has been stored
+	uint8_t codes[72] __attribute__((aligned(16))) = {0};
+	square sq = 56, file = 0, rank = 7;
 
-	/* Parse board */
-	while (sq != 8 || file != 8)
+	/* Parse board, storing the code of each square */
+	for (unsigned char c; (c = *fen_string) != ' '; fen_string += 1)
 	{
-		const char c = *fen_string++;
-		const char lower_mask = 0x20;
+		unsigned code = fen_board_chars[c & 0x7f];
+		if (code == 0 || c >= 0x80) return NULL;
 
-		if (file > 8) goto error;
-
-		/* end of rank */
-		if (file == 8) {
-			if (c != '/') goto error;
-			sq += S+S, file = 0;
+		/* a rank must be complete before the next one starts */
+		if (code & FEN_RANK) {
+			if (file != 8 || rank == 0) return NULL;
+			sq += S+S, rank -= 1, file = 0;
 			continue;
 		}
 
-		/* blank squares */
-		if ('1' <= c && c <= '8') {
-			square offset =	c - '0';
-			sq += offset, file += offset;
-		}
+		/* digits have no piece bits set, so they store an empty square */
+		unsigned step = code >> 4;
+		codes[sq] = code & 0xf;
+		sq += step, file += step;
+		if (file > 8) return NULL;
+	}
 
-		else {
-			piecetype piece = piece_lookup[c | lower_mask];
-			if (piece == NONE) goto error;
+	if (rank != 0 || file != 8) return NULL;
 
-			/* Check if piece is black */
-			set_square(&board, sq, piece);
-			if (c & lower_mask) board.white ^= 1ull << sq;
+	/* Gather each bit of the codes into a bitboard, 16 squares at a time */
+	bitboard black = 0;
 
-			sq += 1, file += 1;
-		}
+	for (square i = 0; i < 64; i += 16) {
+		__m128i v = _mm_load_si128((const __m128i *) (codes + i));
+
+		board.x |= (bitboard) _mm_movemask_epi8(_mm_slli_epi16(v, 7)) << i;
+		board.y |= (bitboard) _mm_movemask_epi8(_mm_slli_epi16(v, 6)) << i;
+		board.z |= (bitboard) _mm_movemask_epi8(_mm_slli_epi16(v, 5)) << i;
+		black   |= (bitboard) _mm_movemask_epi8(_mm_slli_epi16(v, 4)) << i;
 	}
 
+	board.white = occupied(board) &~ black;
+
 	/* space separator */
-	if (*fen_string++ != ' ') goto error;
+	if (*fen_string++ != ' ') return NULL;
 
 	/* parse side-to-move */
 	switch (*fen_string++) {
 		case 'w': *white_to_move = true; break;
 		case 'b': *white_to_move = false; break;
-		default : goto error;
+		default : return NULL;
 	}
 
 	/* space separator */
-	if (*fen_string++ != ' ') goto error;
+	if (*fen_string++ != ' ') return NULL;
 
 	/* parse castling rights */
 	enum { A8 = 56, H8 = 63 };
@@ -85,7 +109,7 @@ board parse_fen(const char *fen_string, bool *white_to_move, bool *ok)
 			case 'Q': castling_mask |= 1ull << A1; break;
 			case 'k': castling_mask |= 1ull << H8; break;
 			case 'q': castling_mask |= 1ull << A8; break;
-			default : goto error;
+			default : return NULL;
 		}
 
 		/* flip rooks to castles */
@@ -93,42 +117,163 @@ board parse_fen(const char *fen_string, bool *white_to_move, bool *ok)
 	}
 
 	/* space separator */
-	if (*fen_string++ != ' ') goto error;
+	if (*fen_string++ != ' ') return NULL;
 
 	/* parse en-passant */
 	bitboard en_passant_mask = 0;
 
-	if (*fen_string != '-') {
+	if (*fen_string == '-')
+		fen_string += 1;
+
+	else {
 		square file = *fen_string++ - 'a';
 		square rank = *fen_string++ - '1';
 
-		if (file >= 8 || rank >= 8) goto error;
+		if (file >= 8 || rank >= 8) return NULL;
 
 		square en_passant = (rank << 3) + file;
 		en_passant_mask = 1ull << en_passant;
 	}
 
-	/* There is more FEN info after this point such as movenumber and 50 move clock but we don't
-	 * care about this information yet. TODO: handle this information
-	 */
+	/* parse halfmove clock and fullmove number */
+	*halfmove = 0, *fullmove = 1;
+
+	if (fen_string[0] == ' ' && '0' <= fen_string[1] && fen_string[1] <= '9') {
+		unsigned half = 0, full = 0;
+		fen_string += 1;
+
+		while ('0' <= *fen_string && *fen_string <= '9')
+			half = half * 10 + (*fen_string++ - '0');
+
+		if (*fen_string++ != ' ') return NULL;
+		if (*fen_string < '0' || *fen_string > '9') return NULL;
+
+		while ('0' <= *fen_string && *fen_string <= '9')
+			full = full * 10 + (*fen_string++ - '0');
+
+		*halfmove = half, *fullmove = full;
+	}
 
 	/* Rotate bitboards if black is the side to move */
 	if (*white_to_move)
 		board.white |= en_passant_mask;
 
 	else {
-		bitboard black = occupied(board) &~ board.white;
-
 		board.x = bswap(board.x);
 		board.y = bswap(board.y);
 		board.z = bswap(board.z);
 		board.white = bswap(black | en_passant_mask);
 	}
 
-	*ok = true;
-	return board;
+	*result = board;
+	return fen_string;
+}
 
-error:
-	*ok = false;
+
+board parse_fen_clocks(const char *fen_string, bool *white_to_move, unsigned *halfmove, unsigned *fullmove, bool *ok)
+{
+	board board = {0};
+	*ok = parse_fen_fields(fen_string, &board, white_to_move, halfmove, fullmove) != NULL;
 	return board;
 }
+
+
+board parse_fen(const char *fen_string, bool *white_to_move, bool *ok)
+{
+	unsigned halfmove, fullmove;
+	return parse_fen_clocks(fen_string, white_to_move, &halfmove, &fullmove, ok);
+}
+
+
+//  Write a position as FEN, undoing the rotation for black to move. The buffer must have space for
+//  at least MAX_FEN_LENGTH characters, the length of the (null-terminated) FEN is returned. The
+//  longest FEN is 71 characters of board, " w KQkq e3 ", two 10-digit clocks and the terminator.
+
+#define MAX_FEN_LENGTH 128
+
+char *write_fen_number(char *out, unsigned n)
+{
+	char digits[10];
+	unsigned count = 0;
+
+	do digits[count++] = '0' + n % 10; while (n /= 10);
+	while (count) *out++ = digits[--count];
+
+	return out;
+}
+
+
+const char fen_piece_chars[16] = "?PNBRRQK?pnbrrqk"; // indexed by piecetype | FEN_BLACK
+
+size_t write_fen(char *fen_string, board board, bool white_to_move, unsigned halfmove, unsigned fullmove)
+{
+	char *out = fen_string;
+	bitboard occ = occupied(board);
+	bitboard en_passant = board.white &~ occ;
+	bitboard black = occ &~ board.white;
+
+	if (!white_to_move) {
+		board.x = bswap(board.x);
+		board.y = bswap(board.y);
+		board.z = bswap(board.z);
+		black = bswap(board.white & occ);
+		en_passant = bswap(en_passant);
+		occ = bswap(occ);
+	}
+
+	/* write board */
+	for (int rank = 7; rank >= 0; rank -= 1) {
+		unsigned row = occ >> (rank << 3) & 0xff;
+		unsigned file = 0;
+
+		for bits(row) {
+			unsigned next = ctz(row);
+			square sq = rank << 3 | next;
+
+			unsigned code = piece_on(board, sq) | (black >> sq & 1) << 3;
+
+			if (next > file) *out++ = '0' + (next - file);
+			*out++ = fen_piece_chars[code];
+			file = next + 1;
+		}
+
+		if (file < 8) *out++ = '0' + (8 - file);
+		if (rank) *out++ = '/';
+	}
+
+	/* side to move */
+	*out++ = ' ';
+	*out++ = white_to_move ? 'w' : 'b';
+	*out++ = ' ';
+
+	/* castling rights, castles decay to rooks so the CASTLE pieces are the rights left */
+	enum { A8 = 56, H8 = 63 };
+	bitboard castles = extract(board, CASTLE);
+	char *rights = out;
+
+	if (castles & ~black & (1ull << H1)) *out++ = 'K';
+	if (castles & ~black & (1ull << A1)) *out++ = 'Q';
+	if (castles &  black & (1ull << H8)) *out++ = 'k';
+	if (castles &  black & (1ull << A8)) *out++ = 'q';
+	if (out == rights) *out++ = '-';
+
+	/* en-passant */
+	*out++ = ' ';
+
+	if (en_passant) {
+		square sq = ctz(en_passant);
+		*out++ = 'a' + (sq & 7);
+		*out++ = '1' + (sq >> 3);
+	}
+
+	else *out++ = '-';
+
+	/* clocks */
+	*out++ = ' ';
+	out = write_fen_number(out, halfmove);
+	*out++ = ' ';
+	out = write_fen_number(out, fullmove);
+
+	*out = '\0';
+	return out - fen_string;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <string.h>
+
+#include "board.h"
+#include "fen.h"
+#include "hash.h"
+#include "movegen.h"
+
+// The game-state layer wraps a board with everything that is not needed for move generation: the
+// side to move, the 50-move clock, the fullmove number, and a history of previous positions for
+// repetition detection. It also keeps a hash of the position which, unlike `hash_board`, is from
+// white's (absolute) perspective and includes the side to move, so it can be used as a key for a
+// search transposition table and to compare positions across plies.
+//
+// The hash is updated incrementally on every move: only the squares that differ between the board
+// before and after the move are rehashed, which is usually two to four squares.
+//
+// The history holds at most MAX_GAME_PLIES moves, the make functions return false and leave the
+// game unchanged when it is full. A caller that never unmakes moves can trim the history to the
+// positions that may still repeat instead (see trim_game_history).
+
+#define MAX_GAME_PLIES 1024
+#define REPETITION_FILTER_SIZE 4096 // must be a power of two
+
+typedef struct { board board; uint64_t hash; unsigned halfmove; } game_state;
+
+typedef struct {
+	board board;
+	uint64_t hash;
+	bool white_to_move;
+	unsigned halfmove, fullmove;
+
+	// Previous states are pushed on a stack for unmake, which doubles as the repetition history.
+	// The filter counts the positions in the history (and the current one) by the low bits of their
+	// hash, so most positions can be ruled out as repetitions without scanning the history.
+
+	size_t ply;
+	game_state history[MAX_GAME_PLIES];
+	uint16_t filter[REPETITION_FILTER_SIZE];
+} game;
+
+
+// Lookup the key of a square of a board from white's perspective. A black-to-move board is
+// rotated, so the square is flipped vertically and the colour of any piece is swapped. The
+// en-passant marker has no colour so it is left alone.
+
+uint64_t absolute_square_key(board board, square sq, bool white_to_move)
+{
+	unsigned code = square_code(board, sq);
+	if (white_to_move) return zobrist_keys[code][sq];
+
+	if (code & 7) code ^= 8;
+	return zobrist_keys[code][sq ^ 56];
+}
+
+
+uint64_t hash_position(board board, bool white_to_move)
+{
+	uint64_t hash = white_to_move ? 0 : zobrist_black;
+	bitboard squares = occupied(board) | board.white;
+
+	for bits(squares)
+		hash ^= absolute_square_key(board, ctz(squares), white_to_move);
+
+	return hash;
+}
+
+
+void init_game(game *game, board board, bool white_to_move, unsigned halfmove, unsigned fullmove)
+{
+	game->board = board;
+	game->hash = hash_position(board, white_to_move);
+	game->white_to_move = white_to_move;
+	game->halfmove = halfmove;
+	game->fullmove = fullmove;
+	game->ply = 0;
+
+	memset(game->filter, 0, sizeof game->filter);
+	game->filter[game->hash & (REPETITION_FILTER_SIZE - 1)] += 1;
+}
+
+
+bool init_game_fen(game *game, const char *fen)
+{
+	bool white_to_move, ok;
+	unsigned halfmove, fullmove;
+
+	board board = parse_fen_clocks(fen, &white_to_move, &halfmove, &fullmove, &ok);
+	if (ok) init_game(game, board, white_to_move, halfmove, fullmove);
+
+	return ok;
+}
+
+
+// Push the new board after a move. The new board is rotated back into the perspective of the side
+// that just moved, so that the boards before and after can be compared square by square. In that
+// perspective the 'white' bitboard holds the pieces of the side that moved and the en-passant
+// marker, just like the board before the move.
+
+bool push_game_state(game *game, board next, bool reset_clock)
+{
+	if (game->ply == MAX_GAME_PLIES) return false;
+
+	board prev = game->board;
+	bitboard occ = occupied(next);
+
+	board back = {
+		bswap(next.x), bswap(next.y), bswap(next.z),
+		bswap(occ ^ next.white), // = our pieces (now enemy), and new en-passant marker (empty square)
+	};
+
+	bitboard changed = (prev.x ^ back.x) | (prev.y ^ back.y) | (prev.z ^ back.z) | (prev.white ^ back.white);
+	uint64_t hash = game->hash ^ zobrist_black;
+
+	for bits(changed) {
+		square sq = ctz(changed);
+		hash ^= absolute_square_key(prev, sq, game->white_to_move)
+		      ^ absolute_square_key(back, sq, game->white_to_move);
+	}
+
+	game->history[game->ply++] = (game_state) { prev, game->hash, game->halfmove };
+
+	game->board = next;
+	game->hash = hash;
+	game->halfmove = reset_clock ? 0 : game->halfmove + 1;
+	game->fullmove += !game->white_to_move;
+	game->white_to_move = !game->white_to_move;
+
+	game->filter[hash & (REPETITION_FILTER_SIZE - 1)] += 1;
+	return true;
+}
+
+
+// Make a move, the 50-move clock is reset by captures and any move of a pawn (including promotion).
+
+bool make_game_move(game *game, move move)
+{
+	board board = game->board;
+	bitboard from = 1ull << M_INIT(move);
+	bitboard to   = 1ull << M_DEST(move);
+
+	bool capture = to & occupied(board) &~ board.white;
+	bool pawn    = from & extract(board, PAWN);
+
+	return push_game_state(game, make_move(board, move), capture || pawn);
+}
+
+
+bool make_game_pawn_push(game *game, square dest)
+{
+	return push_game_state(game, make_pawn_push(game->board, dest), true);
+}
+
+
+void unmake_game_move(game *game)
+{
+	game->filter[game->hash & (REPETITION_FILTER_SIZE - 1)] -= 1;
+
+	game_state state = game->history[--game->ply];
+
+	game->board = state.board;
+	game->hash = state.hash;
+	game->halfmove = state.halfmove;
+	game->white_to_move = !game->white_to_move;
+	game->fullmove -= !game->white_to_move;
+}
+
+
+// Drop the states before the last irreversible move from the history, as they can no longer repeat.
+// If there are none, the older half of the history is dropped, so repetitions across more than
+// MAX_GAME_PLIES / 2 reversible plies are missed. The dropped moves cannot be unmade.
+
+void trim_game_history(game *game)
+{
+	size_t keep = (game->halfmove < game->ply) ? game->halfmove : game->ply / 2;
+	size_t drop = game->ply - keep;
+
+	for (size_t i = 0; i < drop; i += 1)
+		game->filter[game->history[i].hash & (REPETITION_FILTER_SIZE - 1)] -= 1;
+
+	memmove(game->history, game->history + drop, keep * sizeof *game->history);
+	game->ply = keep;
+}
+
+
+// Check if the current position has occurred before. Positions can only repeat since the last
+// irreversible move (reset of the 50-move clock), and only with the same side to move, so we only
+// scan every other position up to there. In almost all positions the filter has only counted the
+// current position, and we can return without scanning at all.
+
+bool is_repetition(const game *game)
+{
+	if (game->filter[game->hash & (REPETITION_FILTER_SIZE - 1)] <= 1)
+		return false;
+
+	size_t limit = (game->halfmove < game->ply) ? game->halfmove : game->ply;
+
+	for (size_t back = 2; back <= limit; back += 2)
+		if (game->history[game->ply - back].hash == game->hash) return true;
+
+	return false;
+}
+
+
+// Check for a draw by the 50-move rule or by repetition. Note: a checkmate on the move that
+// reaches the 50-move limit is not a draw, so a caller in a search should check for mate first.
+
+bool is_draw(const game *game)
+{
+	return game->halfmove >= 100 || is_repetition(game);
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+
+#ifdef PRECOMPUTED_BITBASE
+#error gentables must be built without -DPRECOMPUTED_BITBASE, as it generates those tables
+#endif
+
+#include "bitbase.h"
+
+//  Generate the bitbase tables as C source, to be compiled in as const data with
+//  -DPRECOMPUTED_BITBASE. The layout of the tables depends on the build options, so this must be
+//  built with the same options as the program that will use the tables.
+//
+//  usage: gentables > bitbase_tables.h
+
+void print_bitboards(const char *name, const char *type, const bitboard *table, size_t count)
+{
+	printf("const %s %s = {", type, name);
+
+	for (size_t i = 0; i < count; i += 1)
+		printf("%s0x%016llx,", (i % 4) ? " " : "\n\t", (unsigned long long) table[i]);
+
+	printf("\n};\n\n");
+}
+
+
+void print_line_between()
+{
+	printf("const bitboard line_between[64][64] = {\n");
+
+	for (square a = 0; a < 64; a += 1) {
+		printf("\t{");
+
+		for (square b = 0; b < 64; b += 1)
+			printf("%s0x%016llx,", (b % 4) ? " " : "\n\t\t", (unsigned long long) line_between[a][b]);
+
+		printf("\n\t},\n");
+	}
+
+	printf("};\n\n");
+}
+
+
+void print_sliding_attacks()
+{
+	printf("const slider_entry sliding_attacks[MAGIC_BITBASE_SIZE] = {");
+
+	for (size_t i = 0; i < MAGIC_BITBASE_SIZE; i += 1) {
+#ifdef COMPACT_BITBASE
+		printf("%s0x%04x,", (i % 8) ? " " : "\n\t", sliding_attacks[i]);
+#else
+		printf("%s0x%016llx,", (i % 4) ? " " : "\n\t", (unsigned long long) sliding_attacks[i]);
+#endif
+	}
+
+	printf("\n};\n\n");
+}
+
+
+void print_magics(const char *name, const magic *magics)
+{
+	printf("const magic %s[64] = {\n", name);
+
+	for (square sq = 0; sq < 64; sq += 1) {
+		magic m = magics[sq];
+		size_t offset = m.attacks - sliding_attacks;
+
+#ifdef COMPACT_BITBASE
+		printf("\t{ 0x%016llx, 0x%016llx, sliding_attacks + %zu },\n",
+		       (unsigned long long) m.mask, (unsigned long long) m.rays, offset);
+#else
+		printf("\t{ 0x%016llx, sliding_attacks + %zu },\n", (unsigned long long) m.mask, offset);
+#endif
+	}
+
+	printf("};\n\n");
+}
+
+
+int main()
+{
+	init_bitbase_tables();
+
+	printf("// Generated by gentables.c, do not edit.\n\n");
+
+	// the layout of the tables must match the one the program is built with
+#ifdef COMPACT_BITBASE
+	printf("#ifndef COMPACT_BITBASE\n#error bitbase_tables.h was generated for COMPACT_BITBASE\n#endif\n\n");
+#else
+	printf("#ifdef COMPACT_BITBASE\n#error bitbase_tables.h was generated without COMPACT_BITBASE\n#endif\n\n");
+#endif
+
+	print_bitboards("knight_attacks[64]", "bitboard", knight_attacks, 64);
+	print_bitboards("king_attacks[64]",   "bitboard", king_attacks,   64);
+	print_line_between();
+
+	print_sliding_attacks();
+	print_magics("bishop_magics", bishop_magics);
+	print_magics("rook_magics",   rook_magics);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bitboard.h"
+#include "board.h"
+
+// Zobrist hashing of the compressed board. Every square is given a 4 bit code made of its [xyz]
+// piece bits and its 'white' bit, so one key table covers pieces of either colour, castles (the
+// castling rights) and the en-passant marker (an empty square with the white bit set). Empty
+// squares have code 0 and do not contribute to the hash.
+//
+// Note: since the board is always stored from the perspective of the side to move, this hashes the
+// position relative to the side to move. Colour-flipped positions share a hash, which is exactly
+// what we want for perft where the counts are the same.
+
+uint64_t zobrist_keys[16][64];
+uint64_t zobrist_black; // black to move, only used when hashing absolute positions (see game.h)
+
+
+unsigned square_code(board board, square sq)
+{
+	return piece_on(board, sq) | (board.white >> sq & 1) << 3;
+}
+
+
+uint64_t hash_board(board board)
+{
+	uint64_t hash = 0;
+	bitboard squares = occupied(board) | board.white;
+
+	for bits(squares) {
+		square sq = ctz(squares);
+		hash ^= zobrist_keys[square_code(board, sq)][sq];
+	}
+
+	return hash;
+}
+
+
+//  Positions without castling rights have the same perft counts as their mirror image (en-passant
+//  is mirrored along with the pawns), so they can share a hash: the smaller of the hashes of the
+//  position and of its mirror, which are computed in the same pass. Positions with castles of
+//  either side are hashed as they are.
+
+uint64_t symmetric_hash_board(board board)
+{
+	if (extract(board, CASTLE)) return hash_board(board);
+
+	uint64_t hash = 0, mirrored = 0;
+	bitboard squares = occupied(board) | board.white;
+
+	for bits(squares) {
+		square sq = ctz(squares);
+		unsigned code = square_code(board, sq);
+
+		hash     ^= zobrist_keys[code][sq];
+		mirrored ^= zobrist_keys[code][sq ^ 7];
+	}
+
+	return hash < mirrored ? hash : mirrored;
+}
+
+
+// SplitMix64 (Steele, Lea & Flood) as a small, fixed-seed generator, so keys are the same across
+// processes and runs, which allows hashes to be stored.
+
+uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+
+void init_zobrist_keys()
+{
+	uint64_t state = 0x6d756f6e; // "muon"
+
+	for (unsigned code = 1; code < 16; code += 1)
+		for (square sq = 0; sq < 64; sq += 1) zobrist_keys[code][sq] = splitmix64(&state);
+
+	zobrist_black = splitmix64(&state);
+}
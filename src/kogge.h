@@ -0,0 +1,99 @@
+#pragma once
+
+#include "bitboard.h"
+
+//  Table-free sliding attacks for enemy_attacked and generate_pinned, selected by compiling with
+//  -DKOGGE_STONE_SLIDERS. The 1MB of sliding_attacks competes for the caches with everything else
+//  an engine keeps in memory (its hash table, evaluation weights), and every lookup that misses
+//  costs more than computing the attacks outright. Here the eight directions are the eight lanes
+//  of a zmm register, and all sliders of a side are filled in every direction at once with
+//  Kogge-Stone occluded fills, in three steps of variable shifts. Queens are in both the rook and
+//  the bishop lanes. The moves of our own pieces still use the tables, as they are needed one
+//  piece at a time.
+//
+//  With the tables in cache, lookups are faster: perft (which counts the leaves of a position from
+//  its enemy attacks and pins) runs about a quarter slower with the fills. The search workload of
+//  bench.c, which spends more of its time away from move generation, was about a quarter faster
+//  with the fills both alone and with a cache-thrashing process alongside (bench -x), while the
+//  alpha-beta workload was slower alone and faster with the thrashing.
+//
+//  batch.h uses the same fills with the lanes the other way around: one position per lane, and one
+//  direction at a time.
+//    (Reference: https://www.chessprogramming.org/Kogge-Stone_Algorithm)
+
+#ifndef __AVX512F__
+#error KOGGE_STONE_SLIDERS requires AVX-512
+#endif
+
+// The lanes are the directions N, S, E, W (rook lanes) and N+E, S+W, N+W, S+E (bishop lanes)
+#define ROOK_LANES   0x0f
+#define BISHOP_LANES 0xf0
+
+
+// Shift every lane one step in its direction. Shifts of 64 or more give zero, so each lane only
+// takes the shift left or the shift right.
+
+static inline __m512i shift_directions(__m512i bb, __m512i left, __m512i right)
+{
+	return _mm512_or_si512(_mm512_sllv_epi64(bb, left), _mm512_srlv_epi64(bb, right));
+}
+
+
+// The squares attacked in the direction of each lane, stopping at (and including) the first square
+// that is not empty. The squares that a step would wrap onto are masked out of the empty squares.
+
+__m512i slider_fills(__m512i sliders, bitboard empty)
+{
+	__m512i left  = _mm512_setr_epi64( 8, 64,  1, 64,  9, 64,  7, 64);
+	__m512i right = _mm512_setr_epi64(64,  8, 64,  1, 64,  9, 64,  7);
+	__m512i edges = _mm512_setr_epi64(~0ull, ~0ull, ~AFILE, ~HFILE, ~AFILE, ~HFILE, ~HFILE, ~AFILE);
+
+	__m512i empties = _mm512_and_si512(_mm512_set1_epi64(empty), edges);
+	__m512i step_left = left, step_right = right;
+
+	for (int step = 0; step < 3; step += 1) {
+		sliders = _mm512_or_si512(sliders, _mm512_and_si512(empties, shift_directions(sliders, step_left, step_right)));
+		empties = _mm512_and_si512(empties, shift_directions(empties, step_left, step_right));
+
+		step_left  = _mm512_add_epi64(step_left, step_left);
+		step_right = _mm512_add_epi64(step_right, step_right);
+	}
+
+	return _mm512_and_si512(shift_directions(sliders, left, right), edges);
+}
+
+
+__m512i slider_lanes(bitboard bishops, bitboard rooks)
+{
+	return _mm512_mask_blend_epi64(BISHOP_LANES, _mm512_set1_epi64(rooks), _mm512_set1_epi64(bishops));
+}
+
+
+// Every square attacked by the bishops and rooks (queens in both)
+
+bitboard kogge_slider_attacks(bitboard bishops, bitboard rooks, bitboard occ)
+{
+	return _mm512_reduce_or_epi64(slider_fills(slider_lanes(bishops, rooks), ~occ));
+}
+
+
+//  The checks and pins of enemy sliders, as in generate_pinned: the king is filled out once up to
+//  the first piece in each direction, and once more through our first piece. Where the second fill
+//  ends on a slider of the lane, the whole ray is a pin (or a check, with nothing to pass through).
+
+void kogge_slider_pins(square king, bitboard occ, bitboard own, bitboard bishops, bitboard rooks,
+                       bitboard *hpinned, bitboard *vpinned, bitboard *checks)
+{
+	__m512i sliders = slider_lanes(bishops, rooks);
+	__m512i origin  = _mm512_set1_epi64(1ull << king);
+
+	__m512i ray  = slider_fills(origin, ~occ);
+	__m512i xray = slider_fills(origin, ~occ | (_mm512_reduce_or_epi64(ray) & own));
+
+	*checks |= _mm512_reduce_or_epi64(_mm512_and_si512(ray, sliders));
+
+	__mmask8 pins = _mm512_test_epi64_mask(xray, sliders);
+
+	*hpinned |= _mm512_mask_reduce_or_epi64(pins & ROOK_LANES, xray);
+	*vpinned |= _mm512_mask_reduce_or_epi64(pins & BISHOP_LANES, xray);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "board.h"
+#include "movegen.h"
+
+//  Legality and check tests of a single move, without generating the moves of the position. A
+//  search gets moves from the hash table and killer slots that may not be legal in the position
+//  it is in (after a hash collision, or from a sibling node), and needs to know whether a move
+//  gives check before making it, to extend or prune it.
+//
+//  Moves are encoded as in the movebuffer, with pawn pushes (which generate_moves only returns in
+//  the pawn_push mask) as a move M(init, dest, PAWN) on the same file, as in notation.h.
+
+
+// All pieces of either side that attack a square, with the given occupancy for the sliders
+
+bitboard attackers_to(board board, square sq, bitboard occ)
+{
+	bitboard bit    = 1ull << sq;
+	bitboard pawns  = extract(board, PAWN);
+	bitboard queens = extract(board, QUEEN);
+
+	return (south(east(bit) | west(bit)) & pawns & board.white)
+	     | (north(east(bit) | west(bit)) & pawns &~ board.white)
+	     | (knight_attacks[sq] & extract(board, KNIGHT))
+	     | (king_attacks[sq]   & extract(board, KING))
+	     | (bishop_attacks(sq, occ) & (extract(board, BISHOP) | queens))
+	     | (rook_attacks(sq, occ)   & (extract(board, ROOK)   | queens));
+}
+
+
+// Castling is legal if the castle is still there, the squares between it and the king are empty
+// and the king doesn't castle out of, through or into check (see legal_castling).
+
+bool is_legal_castling(board board, move move)
+{
+	bitboard occ = occupied(board);
+	bitboard corner = (M_DEST(move) == C1) ? 1ull << A1 : 1ull << H1;
+	bitboard path = (M_DEST(move) == C1) ? QATT : KATT;
+
+	if (move != (M(E1, C1, KING) | M_CASTLING) && move != (M(E1, G1, KING) | M_CASTLING)) return false;
+	if (!(extract(board, CASTLE) & corner & rook_attacks(E1, occ))) return false;
+
+	for bits(path)
+		if (attackers_to(board, ctz(path), occ) & occ &~ board.white) return false;
+
+	return true;
+}
+
+
+//  Test whether a move is legal, for any 16 bit value. The move must be one that generate_moves
+//  would return: the piece must be the piece on the initial square (rooks for castles, as they
+//  decay when they move), or the promoted piece for a pawn reaching the last rank, and castling
+//  must be flagged. The move is first checked against the attacks of the piece, and then our king
+//  must not be attacked once the move is made, by looking up its attackers with the occupancy
+//  after the move (which finds both pins and checks that are not resolved).
+
+bool is_legal(board board, move move)
+{
+	square init = M_INIT(move), dest = M_DEST(move);
+	piecetype piece = M_PIECE(move);
+
+	bitboard from = 1ull << init, to = 1ull << dest;
+	bitboard occ  = occupied(board);
+	bitboard ours = board.white & occ;
+
+	if (!(from & ours) || (to & ours)) return false;
+
+	piecetype moved = piece_on(board, init);
+	if (moved == CASTLE) moved = ROOK;
+
+	if (move & M_CASTLING) return moved == KING && is_legal_castling(board, move);
+
+	bitboard captured = to & occ;
+
+	if (moved == PAWN) {
+		bool promotion = (to & RANK8);
+		if (promotion ? (piece < KNIGHT || piece > QUEEN || piece == CASTLE) : piece != PAWN) return false;
+
+		bitboard pushes = north(from) &~ occ;
+		pushes |= north(pushes & RANK3) &~ occ;
+
+		bitboard en_passant = board.white &~ occ;
+		bitboard captures = north(east(from) | west(from)) & ((occ &~ board.white) | en_passant);
+
+		if (!((pushes | captures) & to)) return false;
+
+		if (to & en_passant) captured = south(to);
+	}
+
+	else {
+		if (piece != moved) return false;
+
+		bitboard attacks = (moved == KING) ? king_attacks[init] : generic_attacks(moved, init, occ);
+		if (!(attacks & to)) return false;
+	}
+
+	square king = (moved == KING) ? dest : (square) ctz(extract(board, KING) & ours);
+	bitboard after = ((occ ^ from) | to) &~ (captured &~ to);
+
+	return !(attackers_to(board, king, after) & after &~ board.white &~ captured);
+}
+
+
+//  Test whether a legal move gives check. The move is made, and the enemy king is looked up in
+//  the attack tables from the new position, which covers direct and discovered checks, and the
+//  odd cases of castling, promotion and en-passant without special code.
+
+bool gives_check(board pos, move move)
+{
+	bool push = M_PIECE(move) == PAWN && ((M_INIT(move) ^ M_DEST(move)) & 7) == 0;
+	board next = push ? make_pawn_push(pos, M_DEST(move)) : make_move(pos, move);
+
+	bitboard occ = occupied(next);
+	square king = ctz(extract(next, KING) & next.white);
+
+	return attackers_to(next, king, occ) & occ &~ next.white;
+}
+
+
+//  Whether a board could come from a game, as the move generator is only safe on those: one king
+//  each, the side that just moved not in check, pawns off the last ranks, no more promoted pieces
+//  than missing pawns, castles in the corners next to an unmoved king, and at most one en-passant
+//  square behind an enemy pawn. Boards from untrusted input (FEN, files) must pass it first.
+
+bool is_plausible_side(board board, bitboard side)
+{
+	int pawns = popcnt(extract(board, PAWN) & side);
+	int extra = 0;
+
+	extra += popcnt(extract(board, KNIGHT) & side) > 2 ? popcnt(extract(board, KNIGHT) & side) - 2 : 0;
+	extra += popcnt(extract(board, BISHOP) & side) > 2 ? popcnt(extract(board, BISHOP) & side) - 2 : 0;
+	extra += popcnt(extract(board, ROOK)   & side) > 2 ? popcnt(extract(board, ROOK)   & side) - 2 : 0;
+	extra += popcnt(extract(board, QUEEN)  & side) > 1 ? popcnt(extract(board, QUEEN)  & side) - 1 : 0;
+
+	return popcnt(extract(board, KING) & side) == 1 && pawns + extra <= 8;
+}
+
+
+bool is_plausible_board(board board)
+{
+	bitboard occ = occupied(board);
+	bitboard ours = board.white & occ, theirs = occ &~ board.white;
+	bitboard en_passant = board.white &~ occ;
+	bitboard castles = extract(board, CASTLE);
+
+	if (!is_plausible_side(board, ours) || !is_plausible_side(board, theirs)) return false;
+	if (extract(board, PAWN) & (RANK1 | RANK8)) return false;
+
+	if (castles & ~(1ull << A1 | 1ull << H1 | 1ull << (A1 + 56) | 1ull << (H1 + 56))) return false;
+	if ((castles & ours   & RANK1) && !(extract(board, KING) & ours   & 1ull << E1)) return false;
+	if ((castles & theirs & RANK8) && !(extract(board, KING) & theirs & 1ull << (E1 + 56))) return false;
+	if (castles & ((ours & RANK8) | (theirs & RANK1))) return false;
+
+	if (popcnt(en_passant) > 1 || (en_passant & ~(RANK8 >> 16))) return false;
+	if (en_passant && !(south(en_passant) & extract(board, PAWN) & theirs)) return false;
+
+	square king = ctz(extract(board, KING) & theirs);
+	return !(attackers_to(board, king, occ) & ours);
+}
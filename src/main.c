@@ -1,123 +1,246 @@
-#include <assert.h>
 #include <locale.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "board.h"
-#include "fen.h"
+#include "divide.h"
 #include "movegen.h"
+#include "perft.h"
+#include "suite.h"
+#include "timer.h"
 
 
-//  Unit-testing structure containing an FEN, and the (maximum) depth, as well as a list of expected
-//  perft results at a given depth
+//  The default test suite, in the same EPD format as suite files (see suite.h). Results are from
+//  (https://www.chessprogramming.org/Perft_Results)
 
-typedef struct { const char *name, *FEN; unsigned depth; size_t expected[7]; } unittest;
+const char default_suite[] =
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 "
+	";D1 20 ;D2 400 ;D3 8902 ;D4 197281 ;D5 4865609 ;D6 119060324 ;id \"startpos\"\n"
 
-// Unit-test results we obtained from (https://www.chessprogramming.org/Perft_Results)
-const unittest unit_tests[] =
-{
-	{ .name = "startpos",
-	  .FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-	  .depth = 6,
-	  .expected = { 20, 400, 8902, 197281, 4865609, 119060324 },
-	},
-
-	{ .name = "kiwipete",
-	  .FEN = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
-	  .depth = 5,
-	  .expected = { 48, 2039, 97862, 4085603, 193690690 },
-	},
-
-	{ .name = "tricky en-passant",
-	  .FEN = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
-	  .depth = 7,
-	  .expected = { 14, 191, 2812, 43238, 674624, 11030083, 178633661 },
-	},
-
-	{ .name = "tricky castling",
-	  .FEN = "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq -",
-	  .depth = 6,
-	  .expected = { 6, 264, 9467, 422333, 15833292, 706045033 },
-	},
-
-	{ .name = "tricky castling rotated",
-	  .FEN = "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ -",
-	  .depth = 6,
-	  .expected = { 6, 264, 9467, 422333, 15833292, 706045033 },
-	},
-
-	{ .name = "talkchess",
-	  .FEN = "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ -",
-	  .depth = 5,
-	  .expected = { 44, 1486, 62379, 2103487, 89941194 },
-	},
-
-	{ .name = "normal middlegame",
-	  .FEN = "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - -",
-	  .depth = 5,
-	  .expected = { 46, 2079, 89890, 3894594, 164075551 },
-	},
-};
-
-const size_t count_unit_tests = sizeof unit_tests / sizeof unit_tests[0];
-
-
-size_t perft(board pos, unsigned depth)
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - "
+	";D1 48 ;D2 2039 ;D3 97862 ;D4 4085603 ;D5 193690690 ;id \"kiwipete\"\n"
+
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "
+	";D1 14 ;D2 191 ;D3 2812 ;D4 43238 ;D5 674624 ;D6 11030083 ;D7 178633661 ;id \"tricky en-passant\"\n"
+
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - "
+	";D1 6 ;D2 264 ;D3 9467 ;D4 422333 ;D5 15833292 ;D6 706045033 ;id \"tricky castling\"\n"
+
+	"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - "
+	";D1 6 ;D2 264 ;D3 9467 ;D4 422333 ;D5 15833292 ;D6 706045033 ;id \"tricky castling rotated\"\n"
+
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - "
+	";D1 44 ;D2 1486 ;D3 62379 ;D4 2103487 ;D5 89941194 ;id \"talkchess\"\n"
+
+	"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - "
+	";D1 46 ;D2 2079 ;D3 89890 ;D4 3894594 ;D5 164075551 ;id \"normal middlegame\"\n";
+
+
+// Run one of the test positions with an increasing number of threads (powers of two up to and
+// including the maximum) to see how well the parallel perft scales on this machine.
+
+bool scaling_benchmark(suite_position test, unsigned max_threads, perft_table *table)
 {
-	movebuffer moves = generate_moves(pos);
-	if (depth == 1) return moves.count + popcnt(moves.pawn_push);
+	bool passed = true;
 
-	size_t total = 0;
+	printf("%s, depth %u\n\n", test.name, test.depth);
+	printf("threads        time       mnps     speedup\n");
+	printf("==========================================\n");
+
+	double base = 0;
+
+	for (unsigned threads = 1;; threads *= 2)
+	{
+		if (threads > max_threads) threads = max_threads;
+
+		if (table) clear_perft_table(table);
+
+		double t1 = wall_seconds();
+		size_t nodes = parallel_perft(test.board, test.depth, threads, table);
+		double t2 = wall_seconds();
 
-	for (size_t i = 0; i < moves.count; i += 1) {
-		board child = make_move(pos, moves.buffer[i]);
-		total += perft(child, depth - 1);
+		if (threads == 1) base = t2 - t1;
+		printf("%-7u %10.3fs %10.0f %10.2fx", threads, t2 - t1, nodes / (t2 - t1) / 1e6, base / (t2 - t1));
+
+		if (nodes != test.expected[test.depth]) {
+			printf("  FAILED, expected %zu", test.expected[test.depth]);
+			passed = false;
+		}
+
+		printf("\n");
+		if (threads == max_threads) break;
 	}
 
-	for bits(moves.pawn_push) {
-		board child = make_pawn_push(pos, ctz(moves.pawn_push));
-		total += perft(child, depth - 1);
+	return passed;
+}
+
+
+// Print the leaf count below each root move (in UCI), and their total
+
+bool divide_position(suite_position *position, unsigned threads, perft_table *table)
+{
+	divide_entry entries[MAX_MOVES];
+	size_t count = perft_divide(position->board, position->depth, threads, table, entries);
+	size_t total = 0;
+
+	printf("%s, depth %u\n\n", position->name[0] ? position->name : position->fen, position->depth);
+
+	for (size_t i = 0; i < count; i += 1) {
+		char uci[MAX_MOVE_NOTATION];
+		format_uci(uci, position->board, entries[i].move, position->white_to_move);
+
+		printf("%s: %zu\n", uci, entries[i].nodes);
+		total += entries[i].nodes;
 	}
 
-	return total;
+	bool passed = total == position->expected[position->depth];
+
+	printf("\ntotal: %zu", total);
+	if (!passed) printf("  FAILED, expected %zu", position->expected[position->depth]);
+	printf("\n\n");
+
+	return passed;
 }
 
 
-int main()
+// Print the leaves of a position by category, as in the tables of the reference above
+
+bool stats_position(suite_position *position, unsigned threads)
+{
+	perft_stats stats = {};
+
+	double t1 = wall_seconds();
+	parallel_stats_perft(position->board, position->depth, threads, &stats);
+	double t2 = wall_seconds();
+
+	bool passed = stats.nodes == position->expected[position->depth];
+
+	if (position->name[0]) printf("%-25s", position->name);
+	else printf("line %-20zu", position->line);
+
+	printf(" %-5u %12zu %10zu %8zu %8zu %10zu %9zu %8zu\t(%.0f mnps)", position->depth, stats.nodes, stats.captures,
+	       stats.en_passant, stats.castles, stats.promotions, stats.checks, stats.mates, stats.nodes / (t2 - t1) / 1e6);
+
+	if (!passed) printf("  FAILED, expected %zu", position->expected[position->depth]);
+	printf("\n");
+
+	return passed;
+}
+
+
+//  usage: main [-t threads] [-H megabytes] [-s] [-f suite.epd] [-d depth] [-m] [-D | -c] [-S]
+//    -t  number of threads to run perft with (defaults to all available cores)
+//    -H  size of the shared perft hash table, by default perft is run without one
+//    -S  share the entries of the hash table between mirror images of positions (see perft.h)
+//    -s  run a scaling benchmark from 1 up to the number of threads instead of the tests
+//    -f  run the positions of an EPD perft suite instead of the default ones
+//    -d  maximum depth to test the positions to (by default the deepest expected)
+//    -m  print the results in a machine-readable format (see suite.h)
+//    -D  perft divide: print the leaf count below each root move of each position
+//    -c  count the leaves by category (captures, en-passant, castles, promotions, checks, mates),
+//        over the threads of -t but without the hash table
+//
+//  Exits with status 1 if any position fails.
+
+int main(int argc, char **argv)
 {
 	init_bitbase_tables();
+	init_zobrist_keys();
 	setlocale(LC_NUMERIC, "");
 
-	clock_t ticks = 0;
-	size_t total_nodes = 0;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned threads = (cores > 0) ? cores : 1;
+	unsigned max_depth = MAX_SUITE_DEPTH;
+	size_t megabytes = 0;
+	bool scaling = false, machine_readable = false, divide = false, categories = false, symmetric = false;
+	const char *path = NULL;
+
+	for (int opt; (opt = getopt(argc, argv, "t:H:sf:d:mDcS")) != -1;) {
+		switch (opt) {
+			case 't': threads = strtoul(optarg, NULL, 10); break;
+			case 'H': megabytes = strtoull(optarg, NULL, 10); break;
+			case 's': scaling = true; break;
+			case 'f': path = optarg; break;
+			case 'd': max_depth = strtoul(optarg, NULL, 10); break;
+			case 'm': machine_readable = true; break;
+			case 'D': divide = true; break;
+			case 'c': categories = true; break;
+			case 'S': symmetric = true; break;
+			default : fprintf(stderr, "usage: %s [-t threads] [-H megabytes] [-s] [-f suite.epd] [-d depth] [-m] [-D | -c] [-S]\n", argv[0]); return 1;
+		}
+	}
 
-	printf("name                      depth       nodes    \n");
-	printf("===============================================\n");
+	if (threads == 0) threads = 1;
 
-	for (size_t index = 0; index < count_unit_tests; index += 1)
-	{
-		unittest test = unit_tests[index];
+	if (symmetric && !megabytes) {
+		fprintf(stderr, "-S needs a hash table (-H)\n");
+		return 1;
+	}
+
+	epd_file file = { default_suite, sizeof default_suite - 1 };
 
-		bool white_to_move, ok;
-		board board = parse_fen(test.FEN, &white_to_move, &ok);
-		assert(ok && "FEN parsing failed!");
+	if (path && !open_epd_file(path, &file)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return 1;
+	}
 
-		clock_t t1 = clock();
-		size_t nodes = perft(board, test.depth);
-		clock_t t2 = clock();
+	suite_position *positions;
+	size_t count = load_suite(file, max_depth, &positions);
 
-		total_nodes += nodes;
-		ticks += t2 - t1;
+	if (count == 0) {
+		fprintf(stderr, "no positions to test\n");
+		return 1;
+	}
+
+	perft_table storage, *table = NULL;
+	if (megabytes) storage = create_perft_table(megabytes), table = &storage;
+	if (table) table->symmetric = symmetric;
+
+	if (scaling)
+		return scaling_benchmark(positions[count > 1 ? 1 : 0], threads, table) ? 0 : 1;
+
+	if (divide || categories) {
+		size_t failed = 0;
+
+		if (categories) {
+			printf("name                      depth        nodes   captures     e.p.  castles promotions    checks    mates\n");
+			printf("=========================================================================================================\n");
+		}
+
+		for (size_t i = 0; i < count; i += 1)
+			failed += !(categories ? stats_position(&positions[i], threads) : divide_position(&positions[i], threads, table));
+
+		if (failed) printf("FAILED: %zu of %zu positions\n", failed, count);
+		return failed ? 1 : 0;
+	}
+
+	if (!machine_readable) {
+		printf("threads: %u, hash: %zu MB, positions: %zu\n\n", threads, megabytes, count);
+		printf("name                      depth       nodes    \n");
+		printf("===============================================\n");
+	}
+
+	suite_result *results = malloc(count * sizeof *results);
+
+	double t1 = wall_seconds();
+	size_t failed = run_suite(positions, results, count, threads, table, machine_readable);
+	double t2 = wall_seconds();
+
+	size_t total_nodes = 0;
 
-		printf("%-25s %-5u       %9zu\t\t(%zu mnps)\n", test.name, test.depth, nodes, nodes * CLOCKS_PER_SEC / (t2 - t1) / 1000000);
+	for (size_t i = 0; i < count; i += 1)
+		total_nodes += results[i].nodes;
 
-		size_t expected = test.expected[test.depth-1];
-		assert(nodes == expected && "TEST FAILED!");
+	if (!machine_readable) {
+		printf("\nNodes per second: %'zu\n", (size_t) (total_nodes / (t2 - t1)));
+		if (failed) printf("FAILED: %zu of %zu positions\n", failed, count);
 	}
 
-	// Calculate time for printing out benchmark
-	double tick_seconds = 1.0 / CLOCKS_PER_SEC;
-	double seconds = ticks * tick_seconds;
+#ifdef MOVEGEN_STATS
+	fprintf(machine_readable ? stderr : stdout, "\n");
+	print_movegen_stats(machine_readable ? stderr : stdout);
+#endif
 
-	printf("\nNodes per second: %'d\n", (int)(total_nodes / seconds));
+	return failed ? 1 : 0;
 }
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "bitbase.h"
+#include "corpus.h"
+#include "counters.h"
+#include "fen.h"
+#include "legal.h"
+#include "movegen.h"
+#include "notation.h"
+#include "see.h"
+#include "timer.h"
+
+//  Microbenchmarks of each stage of move generation on its own, over the fixed corpus of bench.c,
+//  so that a change in perft speed can be attributed to the stage it comes from. The calls of a
+//  stage are timed in small batches to give the distribution of the time per call, and the hardware
+//  counters (see counters.h) are read over all of them.
+//
+//  Batches are timed with the TSC, which is converted to nanoseconds by timing the whole run of
+//  each stage with the wall clock as well.
+
+#define BATCH_CALLS     256
+#define MOVE_SAMPLES    (1 << 20)
+#define NOTATION_BOARDS 4096    // boards that the move lists are kept for, for the notation stages
+
+typedef struct { uint32_t index; move move; } move_sample;     // a move of board_samples[index]
+typedef struct { uint32_t index; square dest; } push_sample;   // a pawn push of board_samples[index]
+
+move_sample *move_samples;
+push_sample *push_samples;
+char (*fen_samples)[MAX_FEN_LENGTH];
+size_t count_move_samples, count_push_samples;
+
+// the moves of the first NOTATION_BOARDS boards, with their UCI and SAN
+movebuffer *notation_moves;
+char (*uci_samples)[MAX_MOVE_NOTATION], (*san_samples)[MAX_MOVE_NOTATION];
+size_t count_notation_samples;
+
+// results are accumulated here, so that the calls can't be optimised away
+uint64_t sink;
+
+
+void collect_move_samples()
+{
+	move_samples = malloc(MOVE_SAMPLES * sizeof *move_samples);
+	push_samples = malloc(MOVE_SAMPLES * sizeof *push_samples);
+	fen_samples  = malloc(count_board_samples * sizeof *fen_samples);
+
+	for (size_t i = 0; i < count_board_samples; i += 1) {
+		movebuffer moves = generate_moves(board_samples[i]);
+
+		for (size_t j = 0; j < moves.count && count_move_samples < MOVE_SAMPLES; j += 1)
+			move_samples[count_move_samples++] = (move_sample) { i, moves.buffer[j] };
+
+		for bits(moves.pawn_push) {
+			if (count_push_samples == MOVE_SAMPLES) break;
+			push_samples[count_push_samples++] = (push_sample) { i, ctz(moves.pawn_push) };
+		}
+
+		// alternate the side to move, so that both orientations are parsed
+		write_fen(fen_samples[i], board_samples[i], i & 1, 0, 1);
+	}
+
+	size_t boards = (count_board_samples < NOTATION_BOARDS) ? count_board_samples : NOTATION_BOARDS;
+	notation_moves = malloc(boards * sizeof *notation_moves);
+
+	for (size_t i = 0; i < boards; i += 1)
+		notation_moves[i] = generate_moves(board_samples[i]);
+
+	while (count_notation_samples < count_move_samples && move_samples[count_notation_samples].index < boards)
+		count_notation_samples += 1;
+
+	uci_samples = malloc(count_notation_samples * sizeof *uci_samples);
+	san_samples = malloc(count_notation_samples * sizeof *san_samples);
+
+	for (size_t i = 0; i < count_notation_samples; i += 1) {
+		move_sample s = move_samples[i];
+		board board = board_samples[s.index];
+
+		format_uci(uci_samples[i], board, s.move, s.index & 1);
+		format_san(san_samples[i], board, s.move, &notation_moves[s.index], s.index & 1);
+	}
+}
+
+
+//  Each stage runs the function being measured over a range of its samples, and returns the
+//  number of calls made.
+
+size_t stage_generate_moves(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += generate_moves(board_samples[i]).count;
+
+	return end - begin;
+}
+
+
+size_t stage_count_moves(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += count_moves(board_samples[i]);
+
+	return end - begin;
+}
+
+
+size_t stage_make_move(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += make_move(board_samples[move_samples[i].index], move_samples[i].move).x;
+
+	return end - begin;
+}
+
+
+size_t stage_make_pawn_push(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += make_pawn_push(board_samples[push_samples[i].index], push_samples[i].dest).x;
+
+	return end - begin;
+}
+
+
+size_t stage_is_legal(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += is_legal(board_samples[move_samples[i].index], move_samples[i].move);
+
+	return end - begin;
+}
+
+
+size_t stage_gives_check(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += gives_check(board_samples[move_samples[i].index], move_samples[i].move);
+
+	return end - begin;
+}
+
+
+size_t stage_see(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += see(board_samples[move_samples[i].index], move_samples[i].move);
+
+	return end - begin;
+}
+
+
+size_t stage_bishop_attacks(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += bishop_attacks(slider_samples[i].sq, slider_samples[i].occ);
+
+	return end - begin;
+}
+
+
+size_t stage_rook_attacks(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1)
+		sink += rook_attacks(slider_samples[i].sq, slider_samples[i].occ);
+
+	return end - begin;
+}
+
+
+size_t stage_parse_fen(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1) {
+		bool white_to_move, ok;
+		sink += parse_fen(fen_samples[i], &white_to_move, &ok).x;
+	}
+
+	return end - begin;
+}
+
+
+size_t stage_format_uci(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1) {
+		char uci[MAX_MOVE_NOTATION];
+		move_sample s = move_samples[i];
+		sink += format_uci(uci, board_samples[s.index], s.move, s.index & 1);
+	}
+
+	return end - begin;
+}
+
+
+size_t stage_parse_uci(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1) {
+		bool ok;
+		move_sample s = move_samples[i];
+		sink += parse_uci(uci_samples[i], board_samples[s.index], &notation_moves[s.index], s.index & 1, &ok);
+	}
+
+	return end - begin;
+}
+
+
+size_t stage_format_san(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1) {
+		char san[MAX_MOVE_NOTATION];
+		move_sample s = move_samples[i];
+		sink += format_san(san, board_samples[s.index], s.move, &notation_moves[s.index], s.index & 1);
+	}
+
+	return end - begin;
+}
+
+
+size_t stage_parse_san(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i += 1) {
+		bool ok;
+		move_sample s = move_samples[i];
+		sink += parse_san(san_samples[i], board_samples[s.index], &notation_moves[s.index], s.index & 1, &ok);
+	}
+
+	return end - begin;
+}
+
+
+typedef struct { const char *name; size_t (*run)(size_t, size_t); size_t *samples; } stage;
+
+const stage stages[] =
+{
+	{ "generate_moves", stage_generate_moves, &count_board_samples },
+	{ "count_moves",    stage_count_moves,    &count_board_samples },
+	{ "make_move",      stage_make_move,      &count_move_samples  },
+	{ "make_pawn_push", stage_make_pawn_push, &count_push_samples  },
+	{ "is_legal",       stage_is_legal,       &count_move_samples  },
+	{ "gives_check",    stage_gives_check,    &count_move_samples  },
+	{ "see",            stage_see,            &count_move_samples  },
+	{ "bishop_attacks", stage_bishop_attacks, &count_slider_samples },
+	{ "rook_attacks",   stage_rook_attacks,   &count_slider_samples },
+	{ "parse_fen",      stage_parse_fen,      &count_board_samples },
+	{ "format_uci",     stage_format_uci,     &count_notation_samples },
+	{ "parse_uci",      stage_parse_uci,      &count_notation_samples },
+	{ "format_san",     stage_format_san,     &count_notation_samples },
+	{ "parse_san",      stage_parse_san,      &count_notation_samples },
+};
+
+const size_t count_stages = sizeof stages / sizeof stages[0];
+
+
+int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+
+//  Run a stage over all of its samples, repeatedly until it has run for the given time. The time
+//  of every batch is recorded for the percentiles.
+
+void run_stage(stage s, double seconds, perf_counters *counters)
+{
+	size_t samples = *s.samples;
+	size_t capacity = 1 << 16, batches = 0, calls = 0;
+	uint64_t *ticks = malloc(capacity * sizeof *ticks);
+	size_t *sizes = malloc(capacity * sizeof *sizes);
+	double counts[COUNTERS];
+
+	// warm up the caches and branch predictors first
+	s.run(0, samples);
+
+	double start = wall_seconds();
+	uint64_t total_ticks = __rdtsc();
+	start_counters(counters);
+
+	do {
+		for (size_t i = 0; i < samples; i += BATCH_CALLS) {
+			size_t end = (i + BATCH_CALLS < samples) ? i + BATCH_CALLS : samples;
+
+			if (batches == capacity) {
+				capacity *= 2;
+				ticks = realloc(ticks, capacity * sizeof *ticks);
+				sizes = realloc(sizes, capacity * sizeof *sizes);
+			}
+
+			uint64_t t1 = __rdtsc();
+			sizes[batches] = s.run(i, end);
+			uint64_t t2 = __rdtsc();
+
+			ticks[batches++] = t2 - t1;
+			calls += sizes[batches - 1];
+		}
+	}
+	while (wall_seconds() - start < seconds);
+
+	stop_counters(counters, counts);
+	total_ticks = __rdtsc() - total_ticks;
+	double ns_per_tick = (wall_seconds() - start) * 1e9 / total_ticks;
+
+	// the time per call of each batch, sorted for the percentiles
+	double *ns = malloc(batches * sizeof *ns);
+
+	for (size_t i = 0; i < batches; i += 1)
+		ns[i] = ticks[i] * ns_per_tick / sizes[i];
+
+	qsort(ns, batches, sizeof *ns, compare_doubles);
+
+	printf("%-16s %11zu %8.2f %8.2f %8.2f %8.2f", s.name, calls, ns[0], ns[batches / 2],
+	       ns[batches * 9 / 10], ns[batches * 99 / 100]);
+
+	for (int i = 0; i < COUNTERS; i += 1) {
+		if (counts[i] < 0) printf(" %10s", "n/a");
+		else printf(" %10.2f", counts[i] / calls);
+	}
+
+	printf("\n");
+	fflush(stdout);
+
+	free(ns);
+	free(sizes);
+	free(ticks);
+}
+
+
+//  usage: microbench [-t seconds] [stage...]
+//    -t  time to run each stage for (default 1 second)
+//    runs every stage by default, or only the stages named
+
+int main(int argc, char **argv)
+{
+	double seconds = 1.0;
+
+	for (int opt; (opt = getopt(argc, argv, "t:")) != -1;) {
+		switch (opt) {
+			case 't': seconds = strtod(optarg, NULL); break;
+			default : fprintf(stderr, "usage: %s [-t seconds] [stage...]\n", argv[0]); return 1;
+		}
+	}
+
+	init_bitbase_tables();
+	collect_corpus();
+	collect_move_samples();
+
+	perf_counters counters = open_counters();
+
+	printf("%-28s%-36s%s\n", "", "           ns per call", "                 counts per call");
+	printf("stage                  calls      min      p50      p90      p99");
+
+	for (int i = 0; i < COUNTERS; i += 1)
+		printf(" %10s", counter_names[i]);
+
+	printf("\n");
+
+	for (size_t i = 0; i < count_stages; i += 1) {
+		bool selected = (optind == argc);
+
+		for (int arg = optind; arg < argc; arg += 1)
+			if (strcmp(argv[arg], stages[i].name) == 0) selected = true;
+
+		if (selected) run_stage(stages[i], seconds, &counters);
+	}
+
+	close_counters(&counters);
+	if (sink == 42) printf(" ");
+}
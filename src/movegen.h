@@ -3,6 +3,11 @@
 #include "bitbase.h"
 #include "bitboard.h"
 #include "board.h"
+#include "stats.h"
+
+#ifdef KOGGE_STONE_SLIDERS
+#include "kogge.h"
+#endif
 
 
 //  Store a compressed move in 16 bits. The 'init' and 'dest' fields store the initial and
@@ -36,6 +41,9 @@ typedef struct { bitboard pawn_push; size_t count; move buffer[MAX_MOVES]; } mov
 // some useful info to pass around to move generation
 typedef struct { bitboard attacked, targets, en_passant, hpinned, vpinned; square king; } movegen_info;
 
+// destination squares of each kind of pawn move, shared by move generation and counting
+typedef struct { bitboard single_move, double_move, east_capture, west_capture; } pawn_targets;
+
 
 void append_move(movebuffer *moves, move move) {
 	moves->buffer[moves->count++] = move;
@@ -65,11 +73,11 @@ void generate_partial_pawn_moves(movebuffer *buffer, bitboard moves, square dire
 }
 
 
-// Generate pawn moves according to a targets mask (where pawns must end their move, for example
-// in case of check this may be restricted), and a pinned mask which indicates pawns that are
-// pinned to our king.
+// Generate pawn destinations according to a targets mask (where pawns must end their move, for
+// example in case of check this may be restricted), and a pinned mask which indicates pawns that
+// are pinned to our king.
 
-void generate_pawn_moves(movebuffer *buffer, movegen_info info, board board)
+pawn_targets generate_pawn_targets(movegen_info info, board board)
 {
 	bitboard pawns   = extract(board, PAWN) & board.white;
 	bitboard occ     = occupied(board);
@@ -82,14 +90,20 @@ void generate_pawn_moves(movebuffer *buffer, movegen_info info, board board)
 
 	bitboard candidates = pawns & south(east(info.en_passant) | west(info.en_passant));
 
+	MOVEGEN_STAT(STAT_EN_PASSANT, info.en_passant);
+
 	// We optimise this branch by only checking if the king is actually on the 5th rank
 	if ((info.king & 56) == 32 && popcnt(candidates) == 1) {
 		bitboard pinners = (extract(board, ROOK) | extract(board, QUEEN)) &~ board.white;
 		bitboard clear = candidates | south(info.en_passant);
 
+		MOVEGEN_STAT(STAT_EN_PASSANT_PIN_TEST, true);
+
 		// If the pawn is "double" pinned, then en-passant is no longer possible
-		if (rook_attacks(info.king, (occ | info.en_passant) &~ clear) & pinners)
+		if (rook_attacks(info.king, (occ | info.en_passant) &~ clear) & pinners) {
+			MOVEGEN_STAT(STAT_EN_PASSANT_PINNED, true);
 			info.en_passant = 0;
+		}
 	}
 
 	// enable en-passant if the pawn being captured was giving check
@@ -118,15 +132,61 @@ void generate_pawn_moves(movebuffer *buffer, movegen_info info, board board)
 	east_capture = (east_capture | pinned_east_capture) & targets;
 	west_capture = (west_capture | pinned_west_capture) & targets;
 
-	buffer->pawn_push = (single_move &~ RANK8) | double_move;
+	MOVEGEN_STAT(STAT_PROMOTIONS, (single_move | east_capture | west_capture) & RANK8);
+
+	return (pawn_targets) { single_move, double_move, east_capture, west_capture };
+}
+
+
+void generate_pawn_moves(movebuffer *buffer, movegen_info info, board board)
+{
+	pawn_targets pawn = generate_pawn_targets(info, board);
+
+	buffer->pawn_push = (pawn.single_move &~ RANK8) | pawn.double_move;
 
 	// promotions, note: double moves cannot promote
-        generate_partial_pawn_moves(buffer, single_move  & RANK8, N,   true);
-        generate_partial_pawn_moves(buffer, east_capture & RANK8, N+E, true);
-        generate_partial_pawn_moves(buffer, west_capture & RANK8, N+W, true);
+	generate_partial_pawn_moves(buffer, pawn.single_move  & RANK8, N,   true);
+	generate_partial_pawn_moves(buffer, pawn.east_capture & RANK8, N+E, true);
+	generate_partial_pawn_moves(buffer, pawn.west_capture & RANK8, N+W, true);
+
+	generate_partial_pawn_moves(buffer, pawn.east_capture &~ RANK8, N+E, false);
+	generate_partial_pawn_moves(buffer, pawn.west_capture &~ RANK8, N+W, false);
+}
+
+
+// Pawn moves split for staged generation (see below), promotions are generated with the captures.
+
+void generate_pawn_captures(movebuffer *buffer, movegen_info info, board board)
+{
+	pawn_targets pawn = generate_pawn_targets(info, board);
+
+	buffer->pawn_push = 0;
+
+	generate_partial_pawn_moves(buffer, pawn.single_move  & RANK8, N,   true);
+	generate_partial_pawn_moves(buffer, pawn.east_capture & RANK8, N+E, true);
+	generate_partial_pawn_moves(buffer, pawn.west_capture & RANK8, N+W, true);
 
-        generate_partial_pawn_moves(buffer, east_capture &~ RANK8, N+E, false);
-        generate_partial_pawn_moves(buffer, west_capture &~ RANK8, N+W, false);
+	generate_partial_pawn_moves(buffer, pawn.east_capture &~ RANK8, N+E, false);
+	generate_partial_pawn_moves(buffer, pawn.west_capture &~ RANK8, N+W, false);
+}
+
+
+void generate_pawn_quiets(movebuffer *buffer, movegen_info info, board board)
+{
+	pawn_targets pawn = generate_pawn_targets(info, board);
+	buffer->pawn_push = (pawn.single_move &~ RANK8) | pawn.double_move;
+}
+
+
+size_t count_pawn_moves(movegen_info info, board board)
+{
+	pawn_targets pawn = generate_pawn_targets(info, board);
+
+	size_t promotions = popcnt(pawn.single_move & RANK8) + popcnt(pawn.east_capture & RANK8)
+	                    + popcnt(pawn.west_capture & RANK8);
+
+	return popcnt(pawn.single_move &~ RANK8) + popcnt(pawn.double_move) + 4 * promotions
+	     + popcnt(pawn.east_capture &~ RANK8) + popcnt(pawn.west_capture &~ RANK8);
 }
 
 
@@ -142,17 +202,30 @@ bitboard generic_attacks(piecetype piece, square sq, bitboard occ)
 }
 
 
-void generate_piece_moves(movebuffer *buffer, movegen_info info, piecetype piece, board board, bool pinned)
+// Select the (friendly) pieces of a type to generate moves for. Pinned pieces are generated
+// separately from the others, and pinned queens are generated along with the bishops or rooks
+// according to the direction they are pinned in. The mask that pinned pieces must stay on to
+// remain aligned to the king is returned in `pin_mask`.
+
+bitboard movable_pieces(movegen_info info, piecetype piece, board board, bool pinned, bitboard *pin_mask)
 {
 	bitboard _pinned = info.hpinned | info.vpinned;
 	if (pinned) _pinned = (piece == BISHOP) ? info.vpinned : info.hpinned;
 
-	bitboard occ    = occupied(board);
 	bitboard pieces = extract(board, piece);
-	bitboard queens = extract(board, QUEEN);
-	if (pinned) pieces |= queens;
+	if (pinned) pieces |= extract(board, QUEEN);
+
+	*pin_mask = _pinned;
+	return pieces & board.white & (pinned ? _pinned : ~_pinned);
+}
+
 
-	pieces &= board.white & (pinned ? _pinned : ~_pinned);
+void generate_piece_moves(movebuffer *buffer, movegen_info info, piecetype piece, board board, bool pinned)
+{
+	bitboard pin_mask;
+	bitboard occ    = occupied(board);
+	bitboard queens = extract(board, QUEEN);
+	bitboard pieces = movable_pieces(info, piece, board, pinned, &pin_mask);
 
 	for bits(pieces) {
 		square init = ctz(pieces);
@@ -161,7 +234,7 @@ void generate_piece_moves(movebuffer *buffer, movegen_info info, piecetype piece
 
 		// If the piece is pinned, then the moves must remain aligned to the king.
 		if (pinned) {
-			attacks &= _pinned;
+			attacks &= pin_mask;
 			if (queens & pieces & -pieces) p = QUEEN;
 		}
 
@@ -173,31 +246,80 @@ void generate_piece_moves(movebuffer *buffer, movegen_info info, piecetype piece
 }
 
 
+size_t count_piece_moves(movegen_info info, piecetype piece, board board, bool pinned)
+{
+	bitboard pin_mask;
+	bitboard occ    = occupied(board);
+	bitboard pieces = movable_pieces(info, piece, board, pinned, &pin_mask);
+	bitboard mask   = info.targets & (pinned ? pin_mask : ~0ull);
+	size_t total = 0;
+
+	for bits(pieces)
+		total += popcnt(generic_attacks(piece, ctz(pieces), occ) & mask);
+
+	return total;
+}
+
+
 // Generate king moves. We use a specialised function rather than the one above as we always have
 // exactly one king so the outer loop can be optimised away. Here we also clear the attacked mask
 // to prevent our king from walking into check.
 
-void generate_king_moves(movebuffer *buffer, movegen_info info, board board)
+bitboard king_targets(movegen_info info, board board)
 {
-	bitboard occ = occupied(board);
-	bitboard attacks = king_attacks[info.king] &~ (info.attacked | (board.white & occ));
+	return king_attacks[info.king] &~ (info.attacked | (board.white & occupied(board)));
+}
+
+
+// Special bitboards to check castling against. The OCC bitboards must not be occupied, and
+// the ATT bitboards must not be attacked, as castling out-of, through or into check is not
+// allowed. Returns the castles (corner squares) that the king can legally castle with.
+
+#define QATT  (1 << C1 | 1 << D1 | 1 << E1)
+#define KATT  (1 << E1 | 1 << F1 | 1 << G1)
+
+bitboard legal_castling(movegen_info info, board board)
+{
+	bitboard castling = extract(board, CASTLE) & rook_attacks(info.king, occupied(board));
+	MOVEGEN_STAT(STAT_CASTLING, extract(board, CASTLE) & (1 << A1 | 1 << H1));
+
+	if (info.attacked & QATT) castling &= ~(1ull << A1);
+	if (info.attacked & KATT) castling &= ~(1ull << H1);
+
+	return castling & (1 << A1 | 1 << H1);
+}
+
+
+void generate_king_steps(movebuffer *buffer, movegen_info info, board board, bitboard mask)
+{
+	bitboard attacks = king_targets(info, board) & mask;
 
 	for bits(attacks) {
 		square dest = ctz(attacks);
 		append_move(buffer, M(info.king, dest, KING));
 	}
+}
+
 
-	bitboard castling = extract(board, CASTLE) & rook_attacks(info.king, occ);
+void generate_castling_moves(movebuffer *buffer, movegen_info info, board board)
+{
+	bitboard castling = legal_castling(info, board);
 
-	// Special bitboards to check castling against. The OCC bitboards must not be occupied, and
-	// the ATT bitboards must not be attacked, as castling out-of, through or into check is not
-	// allowed.
+	if (castling & (1 << A1))  append_move(buffer, M(E1, C1, KING) | M_CASTLING);
+	if (castling & (1 << H1))  append_move(buffer, M(E1, G1, KING) | M_CASTLING);
+}
 
-#define QATT  (1 << C1 | 1 << D1 | 1 << E1)
-#define KATT  (1 << E1 | 1 << F1 | 1 << G1)
 
-	if (castling & (1 << A1) && !(info.attacked & QATT))  append_move(buffer, M(E1, C1, KING) | M_CASTLING);
-	if (castling & (1 << H1) && !(info.attacked & KATT))  append_move(buffer, M(E1, G1, KING) | M_CASTLING);
+void generate_king_moves(movebuffer *buffer, movegen_info info, board board)
+{
+	generate_king_steps(buffer, info, board, ~0ull);
+	generate_castling_moves(buffer, info, board);
+}
+
+
+size_t count_king_moves(movegen_info info, board board)
+{
+	return popcnt(king_targets(info, board)) + popcnt(legal_castling(info, board));
 }
 
 
@@ -229,8 +351,13 @@ bitboard enemy_attacked(board board, bitboard *checks)
 	*checks |= knights & knight_attacks[ctz(our_king)];
 
 	for bits(knights)  attacked |= knight_attacks[ctz(knights)];
+
+#ifdef KOGGE_STONE_SLIDERS
+	attacked |= kogge_slider_attacks(bishops, rooks, occ);
+#else
 	for bits(bishops)  attacked |= bishop_attacks(ctz(bishops), occ);
 	for bits(rooks)    attacked |= rook_attacks(ctz(rooks), occ);
+#endif
 
 	return attacked;
 }
@@ -250,6 +377,9 @@ void generate_pinned(board board, movegen_info *info, bitboard *checks)
         bishops |= queens;
         rooks   |= queens;
 
+#ifdef KOGGE_STONE_SLIDERS
+	kogge_slider_pins(info->king, occ, white, bishops, rooks, &info->hpinned, &info->vpinned, checks);
+#else
 	bitboard bishop_ray = bishop_attacks(info->king, occ);
 	bitboard rook_ray = rook_attacks(info->king, occ);
 
@@ -263,47 +393,235 @@ void generate_pinned(board board, movegen_info *info, bitboard *checks)
 
 	for bits(bishops) info->vpinned |= line_between[info->king][ctz(bishops)];
 	for bits(rooks) info->hpinned |= line_between[info->king][ctz(rooks)];
+#endif
 }
 
 
-// Generate all legal moves for a given position. It is assumed that Board itself is a legal
-// position, otherwise UB may occur (assumptions that we have a king may no longer be true).
+// Generate the info needed for move generation of a position, and the pieces giving check. If
+// in check from a single piece, the targets are restricted to blocking or capturing it.
 
-movebuffer generate_moves(board board)
+movegen_info generate_movegen_info(board board, bitboard *checks)
 {
-        movebuffer moves = {.count = 0};
 	movegen_info info = {};
 
-        info.king = ctz(extract(board, KING) & board.white);
-	bitboard checks = 0;
+	info.king = ctz(extract(board, KING) & board.white);
+	*checks = 0;
 
 	info.en_passant = board.white &~ occupied(board);
 	info.targets = ~(occupied(board) & board.white); // cannot capture own pieces
-        info.attacked = enemy_attacked(board, &checks);
-        generate_pinned(board, &info, &checks);
+	info.attacked = enemy_attacked(board, checks);
+	generate_pinned(board, &info, checks);
+
+	if (*checks) info.targets &= line_between[info.king][ctz(*checks)];
 
-        // If we are in check from more than one piece, then we can only move king otherwise
+	MOVEGEN_STAT(STAT_POSITIONS, true);
+	MOVEGEN_STAT(STAT_CHECK, *checks);
+	MOVEGEN_STAT(STAT_DOUBLE_CHECK, popcnt(*checks) == 2);
+	MOVEGEN_STAT(STAT_PINNED, (info.hpinned | info.vpinned) & board.white & occupied(board));
+
+	return info;
+}
+
+
+// Generate all legal moves of a position from its (already computed) movegen_info.
+
+void generate_moves_from_info(movebuffer *moves, movegen_info info, board board, bitboard checks)
+{
+	moves->count = 0;
+	moves->pawn_push = 0;
+
+	// If we are in check from more than one piece, then we can only move king otherwise
 	// we must block the check, or capture the checking piece
 
 	if (popcnt(checks) == 2) goto double_check;
-	if (checks) info.targets &= line_between[info.king][ctz(checks)];
 
 	// Generate moves of pinned pieces, note: pinned knights can never move
 	if ((info.hpinned | info.vpinned) & board.white) {
-		generate_piece_moves(&moves, info, BISHOP, board, true);
-		generate_piece_moves(&moves, info, ROOK,   board, true);
+		generate_piece_moves(moves, info, BISHOP, board, true);
+		generate_piece_moves(moves, info, ROOK,   board, true);
 	}
 
 	// Generate regular moves for non-pinned pieces
-	generate_pawn_moves (&moves, info, board);
-	generate_piece_moves(&moves, info, KNIGHT, board, false);
-	generate_piece_moves(&moves, info, BISHOP, board, false);
-	generate_piece_moves(&moves, info, ROOK,   board, false);
-	generate_piece_moves(&moves, info, QUEEN,  board, false);
+	generate_pawn_moves (moves, info, board);
+	generate_piece_moves(moves, info, KNIGHT, board, false);
+	generate_piece_moves(moves, info, BISHOP, board, false);
+	generate_piece_moves(moves, info, ROOK,   board, false);
+	generate_piece_moves(moves, info, QUEEN,  board, false);
 
 double_check:
-        generate_king_moves(&moves, info, board);
-        return moves;
+	generate_king_moves(moves, info, board);
+}
+
+
+// Generate all legal moves for a given position. It is assumed that Board itself is a legal
+// position, otherwise UB may occur (assumptions that we have a king may no longer be true).
+
+movebuffer generate_moves(board board)
+{
+	movebuffer moves;
+	bitboard checks;
+	movegen_info info = generate_movegen_info(board, &checks);
+
+	generate_moves_from_info(&moves, info, board, checks);
+	return moves;
+}
+
+
+// Count the legal moves of a position (including pawn pushes) without generating them. This
+// uses the same masks as generate_moves, but sums up the popcounts of the destination masks
+// instead of writing every move to a buffer, which is all we need at the leaves of perft.
+
+size_t count_moves_from_info(movegen_info info, board board, bitboard checks)
+{
+	size_t total = 0;
+
+	if (popcnt(checks) == 2) goto double_check;
+
+	if ((info.hpinned | info.vpinned) & board.white) {
+		total += count_piece_moves(info, BISHOP, board, true);
+		total += count_piece_moves(info, ROOK,   board, true);
+	}
+
+	total += count_pawn_moves (info, board);
+	total += count_piece_moves(info, KNIGHT, board, false);
+	total += count_piece_moves(info, BISHOP, board, false);
+	total += count_piece_moves(info, ROOK,   board, false);
+	total += count_piece_moves(info, QUEEN,  board, false);
+
+double_check:
+	return total + count_king_moves(info, board);
+}
+
+
+size_t count_moves(board board)
+{
+	bitboard checks;
+	movegen_info info = generate_movegen_info(board, &checks);
+
+	return count_moves_from_info(info, board, checks);
+}
+
+
+//  Staged move generation. A search usually cuts off after the first few moves, and quiescence
+//  search only needs captures, so generating the full list of moves up front is wasted work. The
+//  movegen_info of a position is computed once, and the moves are then generated in stages:
+//
+//    captures:  all captures (including en-passant) and all promotions
+//    quiets:    all other moves, pawn pushes are left in the pawn_push mask as usual
+//    evasions:  when in check, all legal moves are generated in a single stage instead, as there
+//               are few of them and most of them must be searched anyway
+//
+//  usage: `for (init_move_stages(&stages, board); next_move_stage(&stages, &moves);) { ... }`
+
+enum move_stage { STAGE_DONE, STAGE_CAPTURES, STAGE_QUIETS, STAGE_EVASIONS };
+
+typedef struct { board board; movegen_info info; bitboard checks; enum move_stage stage; } move_stages;
+
+
+void generate_captures(movebuffer *moves, movegen_info info, board board)
+{
+	bitboard enemy = occupied(board) &~ board.white;
+
+	// Pieces, pinned or not, only target enemy pieces. Pawns use the unrestricted targets, as
+	// promotions and en-passant captures must not be masked out.
+	movegen_info captures = info;
+	captures.targets &= enemy;
+
+	if ((info.hpinned | info.vpinned) & board.white) {
+		generate_piece_moves(moves, captures, BISHOP, board, true);
+		generate_piece_moves(moves, captures, ROOK,   board, true);
+	}
+
+	generate_pawn_captures(moves, info, board);
+	generate_piece_moves(moves, captures, KNIGHT, board, false);
+	generate_piece_moves(moves, captures, BISHOP, board, false);
+	generate_piece_moves(moves, captures, ROOK,   board, false);
+	generate_piece_moves(moves, captures, QUEEN,  board, false);
+	generate_king_steps (moves, info, board, enemy);
+}
+
+
+void generate_quiets(movebuffer *moves, movegen_info info, board board)
+{
+	bitboard empty = ~occupied(board);
+
+	movegen_info quiets = info;
+	quiets.targets &= empty;
+
+	if ((info.hpinned | info.vpinned) & board.white) {
+		generate_piece_moves(moves, quiets, BISHOP, board, true);
+		generate_piece_moves(moves, quiets, ROOK,   board, true);
+	}
+
+	generate_pawn_quiets(moves, info, board);
+	generate_piece_moves(moves, quiets, KNIGHT, board, false);
+	generate_piece_moves(moves, quiets, BISHOP, board, false);
+	generate_piece_moves(moves, quiets, ROOK,   board, false);
+	generate_piece_moves(moves, quiets, QUEEN,  board, false);
+	generate_king_steps (moves, info, board, empty);
+	generate_castling_moves(moves, info, board);
+}
+
+
+void generate_evasions(movebuffer *moves, movegen_info info, board board, bitboard checks)
+{
+	if (popcnt(checks) == 1) {
+		if ((info.hpinned | info.vpinned) & board.white) {
+			generate_piece_moves(moves, info, BISHOP, board, true);
+			generate_piece_moves(moves, info, ROOK,   board, true);
+		}
+
+		generate_pawn_moves (moves, info, board);
+		generate_piece_moves(moves, info, KNIGHT, board, false);
+		generate_piece_moves(moves, info, BISHOP, board, false);
+		generate_piece_moves(moves, info, ROOK,   board, false);
+		generate_piece_moves(moves, info, QUEEN,  board, false);
+	}
+
+	// castling is never possible out of check
+	generate_king_steps(moves, info, board, ~0ull);
+}
+
+
+void init_move_stages(move_stages *stages, board board)
+{
+	stages->board = board;
+	stages->info = generate_movegen_info(board, &stages->checks);
+	stages->stage = stages->checks ? STAGE_EVASIONS : STAGE_CAPTURES;
+}
+
+
+// Generate the moves of the next stage into the buffer (which is cleared first), and return the
+// stage that was generated, or STAGE_DONE when all moves have been generated.
+
+enum move_stage next_move_stage(move_stages *stages, movebuffer *moves)
+{
+	enum move_stage stage = stages->stage;
+
+	moves->count = 0;
+	moves->pawn_push = 0;
+
+	switch (stage) {
+		case STAGE_CAPTURES:
+			generate_captures(moves, stages->info, stages->board);
+			stages->stage = STAGE_QUIETS;
+			break;
+
+		case STAGE_QUIETS:
+			generate_quiets(moves, stages->info, stages->board);
+			stages->stage = STAGE_DONE;
+			break;
+
+		case STAGE_EVASIONS:
+			generate_evasions(moves, stages->info, stages->board, stages->checks);
+			stages->stage = STAGE_DONE;
+			break;
+
+		case STAGE_DONE:
+			break;
+	}
+
+	return stage;
 }
 
 
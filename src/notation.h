@@ -0,0 +1,298 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "board.h"
+#include "movegen.h"
+
+//  Conversion of moves to and from UCI (e2e4, e7e8q) and Standard Algebraic Notation (Nbd7, exd6,
+//  O-O, e8=Q+). Moves are given from the perspective of the side to move, as everywhere else, and
+//  the squares are flipped for black when reading or writing the absolute squares of the notation.
+//
+//  Pawn pushes are not in the move list of a movebuffer, only in its pawn_push mask. Here they are
+//  represented as a move M(init, dest, PAWN) on the same file, which can be told apart from pawn
+//  captures (that always change file), see is_pawn_push and play_move.
+//
+//  Parsing checks the move against the legal moves of the position, which the caller generates
+//  (it usually needs them anyway, to replay games or to disambiguate SAN), so that nothing here
+//  needs to generate moves or allocate. All output buffers must have space for MAX_MOVE_NOTATION
+//  characters, and are null-terminated.
+//    (Reference: https://www.chessprogramming.org/Algebraic_Chess_Notation)
+
+#define MAX_MOVE_NOTATION 8 // the longest SAN move is e.g. "Qa1xb2+" or "exd8=Q#"
+
+const char piece_letters[8] = { '?', 'P', 'N', 'B', 'R', 'R', 'Q', 'K' };    // indexed by piecetype
+const char promotion_letters[8] = { '?', '?', 'n', 'b', '?', 'r', 'q', '?' };
+
+const piecetype letter_pieces[128] = {
+	['N'] = KNIGHT, ['B'] = BISHOP, ['R'] = ROOK, ['Q'] = QUEEN, ['K'] = KING,
+	['n'] = KNIGHT, ['b'] = BISHOP, ['r'] = ROOK, ['q'] = QUEEN,
+};
+
+
+bool is_pawn_push(move move)
+{
+	return M_PIECE(move) == PAWN && ((M_INIT(move) ^ M_DEST(move)) & 7) == 0;
+}
+
+
+// The move of a pawn push to a square in the pawn_push mask of a movebuffer
+
+move pawn_push_move(board board, square dest)
+{
+	square init = (extract(board, PAWN) & board.white & (1ull << (dest - 8))) ? dest - 8 : dest - 16;
+	return M(init, dest, PAWN);
+}
+
+
+board play_move(board board, move move)
+{
+	return is_pawn_push(move) ? make_pawn_push(board, M_DEST(move)) : make_move(board, move);
+}
+
+
+// Absolute squares are the squares of the board seen from white, as used in notation
+
+square absolute_square(square sq, bool white_to_move)
+{
+	return white_to_move ? sq : sq ^ 56;
+}
+
+
+char *write_square(char *out, square sq)
+{
+	*out++ = 'a' + (sq & 7);
+	*out++ = '1' + (sq >> 3);
+	return out;
+}
+
+
+// Returns the square of a name such as "e4", or 64 if it is not a square
+
+square read_square(const char *name)
+{
+	square file = (unsigned char) name[0] - 'a';
+	if (file >= 8) return 64; // don't read past the end of a short string
+
+	square rank = (unsigned char) name[1] - '1';
+	return (rank < 8) ? rank << 3 | file : 64;
+}
+
+
+bool legal_move(const movebuffer *moves, board board, move move)
+{
+	if (is_pawn_push(move))
+		return (moves->pawn_push >> M_DEST(move) & 1) && pawn_push_move(board, M_DEST(move)) == move;
+
+	for (size_t i = 0; i < moves->count; i += 1)
+		if (moves->buffer[i] == move) return true;
+
+	return false;
+}
+
+
+//  UCI notation is just the absolute initial and destination squares, and a promotion piece. Castling
+//  is written as the move of the king (e1g1). The piece of a move is the piece that ends up on the
+//  destination, so the board is needed to tell a promotion from a move of that piece.
+
+size_t format_uci(char *out, board board, move move, bool white_to_move)
+{
+	char *start = out;
+
+	out = write_square(out, absolute_square(M_INIT(move), white_to_move));
+	out = write_square(out, absolute_square(M_DEST(move), white_to_move));
+
+	if (M_PIECE(move) != PAWN && piece_on(board, M_INIT(move)) == PAWN)
+		*out++ = promotion_letters[M_PIECE(move)];
+
+	*out = '\0';
+	return out - start;
+}
+
+
+//  Build the move a UCI string describes in a position, and check that it is legal. The piece of
+//  the move is read from the board, as the notation doesn't include it.
+
+move parse_uci(const char *uci, board board, const movebuffer *moves, bool white_to_move, bool *ok)
+{
+	square init = read_square(uci);
+	square dest = read_square(uci + 2);
+	*ok = false;
+
+	if (init == 64 || dest == 64) return 0;
+
+	init = absolute_square(init, white_to_move);
+	dest = absolute_square(dest, white_to_move);
+
+	piecetype piece = piece_on(board, init);
+	if (piece == CASTLE) piece = ROOK; // castles decay to rooks when they move
+
+	if (piece == PAWN && dest >= 56) {
+		piece = letter_pieces[uci[4] & 0x7f];
+		if (piece == NONE || piece == KING) return 0;
+	}
+
+	move move = M(init, dest, piece);
+	if (piece == KING && (init - dest == 2 || dest - init == 2)) move |= M_CASTLING;
+
+	*ok = legal_move(moves, board, move);
+	return move;
+}
+
+
+//  SAN needs the piece that moves, whether it captures, the squares that tell it apart from other
+//  moves of the same kind of piece to the same square, and whether it gives check or mate. The
+//  piece of a move in the movebuffer is the same as the piece that moved unless it promotes, so
+//  moves of the same kind of piece can be found from the move list alone.
+
+size_t format_san(char *out, board pos, move move, const movebuffer *moves, bool white_to_move)
+{
+	char *start = out;
+	square init = M_INIT(move), dest = M_DEST(move);
+	piecetype moved = piece_on(pos, init);
+	bool capture = (1ull << dest) & occupied(pos) &~ pos.white;
+
+	if (move & M_CASTLING) {
+		size_t n = (dest < init) ? 5 : 3;
+		memcpy(out, "O-O-O", n), out += n;
+	}
+
+	else if (moved == PAWN) {
+		// en-passant captures go to the (empty) en-passant square, which is marked in board.white
+		capture |= (init ^ dest) & 7;
+
+		if (capture) *out++ = 'a' + (init & 7), *out++ = 'x';
+		out = write_square(out, absolute_square(dest, white_to_move));
+
+		if (M_PIECE(move) != PAWN) *out++ = '=', *out++ = piece_letters[M_PIECE(move)];
+	}
+
+	else {
+		bool others = false, same_file = false, same_rank = false;
+
+		for (size_t i = 0; i < moves->count; i += 1) {
+			uint16_t other = moves->buffer[i]; // (the type is shadowed by the argument)
+
+			if (M_DEST(other) != dest || M_INIT(other) == init || M_PIECE(other) != M_PIECE(move))
+				continue;
+
+			if (piece_on(pos, M_INIT(other)) == PAWN) continue; // a promotion to the same piece
+
+			others = true;
+			same_file |= (M_INIT(other) & 7) == (init & 7);
+			same_rank |= (M_INIT(other) >> 3) == (init >> 3);
+		}
+
+		*out++ = piece_letters[M_PIECE(move)];
+
+		square from = absolute_square(init, white_to_move);
+		if (others && (!same_file || same_rank)) *out++ = 'a' + (from & 7);
+		if (others && same_file) *out++ = '1' + (from >> 3);
+
+		if (capture) *out++ = 'x';
+		out = write_square(out, absolute_square(dest, white_to_move));
+	}
+
+	// check or mate
+	board next = play_move(pos, move);
+	bitboard checks;
+	generate_movegen_info(next, &checks);
+
+	if (checks) *out++ = count_moves(next) ? '+' : '#';
+
+	*out = '\0';
+	return out - start;
+}
+
+
+//  Find the legal move a SAN string describes. Check and annotation suffixes (+ # ! ?) are ignored,
+//  and both O-O and 0-0 are accepted for castling, as are promotions without the '='. The move
+//  must match exactly one legal move, otherwise it is ambiguous or illegal and ok is cleared.
+
+move parse_san(const char *san, board board, const movebuffer *moves, bool white_to_move, bool *ok)
+{
+	size_t length = strlen(san);
+	*ok = false;
+
+	while (length && (san[length - 1] == '+' || san[length - 1] == '#' || san[length - 1] == '!' || san[length - 1] == '?'))
+		length -= 1;
+
+	if (length < 2) return 0;
+
+	// castling
+	if (san[0] == 'O' || san[0] == '0') {
+		bool queenside = (length == 5);
+		move castle = M(E1, queenside ? C1 : G1, KING) | M_CASTLING;
+
+		*ok = (length == 3 || length == 5) && legal_move(moves, board, castle);
+		return castle;
+	}
+
+	// the promotion, destination and piece are read from the ends inwards
+	piecetype promotion = NONE;
+
+	if (letter_pieces[san[length - 1] & 0x7f] && san[length - 1] >= 'A' && san[length - 1] <= 'Z') {
+		promotion = letter_pieces[san[length - 1] & 0x7f];
+		length -= 1 + (san[length - 2] == '=');
+	}
+
+	if (length < 2) return 0;
+
+	square dest = read_square(san + length - 2);
+	if (dest == 64) return 0;
+
+	dest = absolute_square(dest, white_to_move);
+
+	piecetype piece = PAWN;
+	size_t begin = 0, end = length - 2;
+
+	if ('A' <= san[0] && san[0] <= 'Z') {
+		piece = letter_pieces[san[0] & 0x7f];
+		if (piece == NONE) return 0;
+		begin = 1;
+	}
+
+	if (end > begin && san[end - 1] == 'x') end -= 1;
+
+	// disambiguation, an (absolute) file and/or rank of the initial square
+	square file = 8, rank = 8;
+
+	for (size_t i = begin; i < end; i += 1) {
+		if ('a' <= san[i] && san[i] <= 'h') file = san[i] - 'a';
+		else if ('1' <= san[i] && san[i] <= '8') rank = absolute_square((san[i] - '1') << 3, white_to_move) >> 3;
+		else return 0;
+	}
+
+	// pawn pushes are not in the move list, and only destinations in the mask have a push
+	if (piece == PAWN && file == 8 && !promotion) {
+		if (!(moves->pawn_push >> dest & 1)) return 0;
+
+		move push = pawn_push_move(board, dest);
+		*ok = legal_move(moves, board, push);
+		return push;
+	}
+
+	if (promotion && piece != PAWN) return 0;
+
+	piecetype result = promotion ? promotion : piece;
+	move found = 0;
+	size_t matches = 0;
+
+	for (size_t i = 0; i < moves->count; i += 1) {
+		move m = moves->buffer[i];
+		square init = M_INIT(m);
+
+		if (M_DEST(m) != dest || M_PIECE(m) != result || (m & M_CASTLING)) continue;
+		if ((piece_on(board, init) == PAWN) != (piece == PAWN)) continue;
+		if (file != 8 && (init & 7) != file) continue;
+		if (rank != 8 && (init >> 3) != rank) continue;
+
+		found = m, matches += 1;
+	}
+
+	// a promotion by a push is in the move list, with the captures
+	*ok = (matches == 1);
+	return found;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bitbase.h"
+#include "pack.h"
+#include "pgn.h"
+#include "timer.h"
+
+//  Convert PGN files to the packed format of pack.h, and read them back.
+
+
+// The initial position and moves of a game, as it is replayed. Games longer than a record can hold
+// are counted but not stored, and then rejected by write_pack_record.
+
+typedef struct {
+	board initial;
+	bool white_to_move;
+	size_t plies;
+	move moves[MAX_PACK_PLIES];
+} move_list;
+
+
+void collect_move(void *context, const game *state, move move)
+{
+	move_list *list = context;
+
+	if (move) {
+		if (list->plies < MAX_PACK_PLIES) list->moves[list->plies] = move;
+		list->plies += 1;
+		return;
+	}
+
+	list->initial = state->board;
+	list->white_to_move = state->white_to_move;
+	list->plies = 0;
+}
+
+
+int pack_pgn(const char *input, const char *output)
+{
+	epd_file file;
+	pack_writer writer;
+
+	if (!open_epd_file(input, &file)) {
+		fprintf(stderr, "could not read %s\n", input);
+		return 1;
+	}
+
+	if (!open_pack_writer(output, &writer)) {
+		fprintf(stderr, "could not write %s\n", output);
+		return 1;
+	}
+
+	static game state;
+	static move_list list;
+	size_t games = 0, skipped = 0, plies = 0;
+
+	const char *end = file.data + file.size;
+	const char *start = next_pgn_game(file.data, file.data, end);
+
+	double t1 = wall_seconds();
+
+	while (start < end) {
+		const char *newline = memchr(start, '\n', end - start);
+		const char *game_end = newline ? next_pgn_game(file.data, newline + 1, end) : end;
+
+		pgn_result result = replay_pgn_game(read_pgn_tags(start, game_end), &state, collect_move, &list);
+		bool ok = result.ok && write_pack_record(&writer, list.initial, list.white_to_move, list.moves, list.plies);
+
+		games += ok, skipped += !ok, plies += ok ? list.plies : 0;
+		start = game_end;
+	}
+
+	bool ok = close_pack_writer(&writer);
+	double t2 = wall_seconds();
+	size_t positions = games + plies;
+
+	fprintf(stderr, "%zu games, %zu positions packed (%zu invalid games skipped) in %.3fs\n", games, positions, skipped, t2 - t1);
+	fprintf(stderr, "%zu bytes, %.2f bytes per position (PGN: %.2f, boards: %zu)\n", (size_t) writer.offset,
+	        (double) writer.offset / positions, (double) file.size / positions, sizeof (board));
+
+	close_epd_file(&file);
+	return ok ? 0 : 1;
+}
+
+
+// Decode every position of a file, in order
+
+int bench_pack(const char *path)
+{
+	pack_file pack;
+
+	if (!open_pack_file(path, &pack)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return 1;
+	}
+
+	size_t positions = 0;
+	uint64_t sink = 0;
+	double t1 = wall_seconds();
+
+	const char *data = pack.file.data + sizeof pack_magic;
+
+	for (size_t i = 0; i < pack.records; i += 1) {
+		pack_record record;
+
+		if (!pack_record_at(&pack, data, &record)) {
+			fprintf(stderr, "record %zu is corrupt\n", i);
+			break;
+		}
+
+		pack_cursor cursor = open_pack_cursor(record);
+		positions += 1;
+
+		while (next_pack_position(&cursor))
+			positions += 1, sink += cursor.board.x;
+
+		if (cursor.ply != cursor.plies) fprintf(stderr, "record %zu is corrupt\n", i);
+		data = next_pack_record(record);
+	}
+
+	double t2 = wall_seconds();
+
+	printf("%zu records, %zu positions in %.3fs (%.0f positions/s, %.2f bytes per position)\n", pack.records,
+	       positions, t2 - t1, positions / (t2 - t1), (double) pack.file.size / (positions ? positions : 1));
+
+	close_pack_file(&pack);
+	if (sink == 42) printf(" ");
+	return 0;
+}
+
+
+int print_pack_record(const char *path, size_t n)
+{
+	pack_file pack;
+
+	if (!open_pack_file(path, &pack)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return 1;
+	}
+
+	if (n >= pack.records) {
+		fprintf(stderr, "record %zu out of range (%zu records)\n", n, pack.records);
+		return 1;
+	}
+
+	pack_record record;
+
+	if (!find_pack_record(&pack, n, &record)) {
+		fprintf(stderr, "record %zu is corrupt\n", n);
+		return 1;
+	}
+
+	pack_cursor cursor = open_pack_cursor(record);
+	char fen[MAX_FEN_LENGTH], uci[MAX_MOVE_NOTATION] = "";
+
+	do {
+		write_fen(fen, cursor.board, cursor.white_to_move, 0, 1);
+		printf("%zu\t%s\t%s\n", cursor.ply, uci, fen);
+
+		// the next move is written with the position it leads to, from the side that played it
+		board before = cursor.board;
+		bool white_to_move = cursor.white_to_move;
+
+		if (!next_pack_position(&cursor)) break;
+		format_uci(uci, before, cursor.last, white_to_move);
+	}
+	while (true);
+
+	if (cursor.ply != cursor.plies) fprintf(stderr, "record %zu is corrupt after ply %zu\n", n, cursor.ply);
+
+	close_pack_file(&pack);
+	return 0;
+}
+
+
+//  usage: pack file.pgn out.pack     pack every valid game of a PGN file (invalid games are skipped)
+//         pack -b file.pack          decode every position of a file, to measure the decoding speed
+//         pack -r n file.pack        write the positions of record n, found through the block index
+
+int main(int argc, char **argv)
+{
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	bool bench = false;
+	long record = -1;
+
+	for (int opt; (opt = getopt(argc, argv, "br:")) != -1;) {
+		switch (opt) {
+			case 'b': bench = true; break;
+			case 'r': record = strtol(optarg, NULL, 10); break;
+			default : goto usage;
+		}
+	}
+
+	if (bench && optind + 1 == argc) return bench_pack(argv[optind]);
+	if (record >= 0 && optind + 1 == argc) return print_pack_record(argv[optind], record);
+	if (!bench && record < 0 && optind + 2 == argc) return pack_pgn(argv[optind], argv[optind + 1]);
+
+usage:
+	fprintf(stderr, "usage: %s file.pgn out.pack | -b file.pack | -r record file.pack\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epd.h"
+#include "legal.h"
+#include "movegen.h"
+#include "notation.h"
+
+//  A compact binary format for games (or any sequences of positions), for training data. Each
+//  record stores its initial board as is, and then each move only as its index among the legal
+//  moves of the position, in the deterministic order of generate_moves followed by the pawn pushes
+//  in order of their destination. Since the number of legal moves is known when decoding, the
+//  indices are packed as the digits of a mixed-radix number: a position with n legal moves costs
+//  exactly log2(n) bits, about 5 bits per move in practice (and nothing for a forced move). With
+//  the record headers and the index, files of 20k to 200k games measured 0.88 to 1.03 bytes per
+//  position, some 30 to 36 times less than storing the 32 byte boards.
+//
+//  The digits are packed into 64-bit words, least significant first, as many per word as fit. The
+//  writer and reader both know the number of legal moves of each position, so they agree on where
+//  each word ends without storing it.
+//
+//  Records are grouped into blocks of about PACK_BLOCK_SIZE bytes, and the file ends with an index
+//  of the blocks, so that any record can be found by decoding at most one block:
+//
+//    "MOVEPACK"  block...  padding  index (pack_block, one per block)  footer (pack_footer)
+//
+//  All values are little-endian, as the code only targets x86.
+
+#define PACK_BLOCK_SIZE (1 << 16)
+#define MAX_PACK_PLIES  0xffff
+
+const char pack_magic[8] = "MOVEPACK";
+
+typedef struct { uint64_t offset, first_record; } pack_block;
+typedef struct { uint64_t index_offset, blocks, records; char magic[8]; } pack_footer;
+
+// The fixed part of a record, followed by `words` 64-bit words of packed moves
+typedef struct __attribute__((packed)) {
+	board board;
+	uint8_t white_to_move;
+	uint16_t plies, words;
+} pack_record_header;
+
+
+// The number of legal moves in a position, the radix of its digit
+
+size_t count_legal_moves(const movebuffer *moves)
+{
+	return moves->count + popcnt(moves->pawn_push);
+}
+
+
+// The index of a move among the legal moves, SIZE_MAX if it is not one of them
+
+size_t move_index(const movebuffer *moves, board board, move move)
+{
+	if (is_pawn_push(move)) {
+		if (!legal_move(moves, board, move)) return SIZE_MAX;
+		return moves->count + popcnt(moves->pawn_push & ((1ull << M_DEST(move)) - 1));
+	}
+
+	for (size_t i = 0; i < moves->count; i += 1)
+		if (moves->buffer[i] == move) return i;
+
+	return SIZE_MAX;
+}
+
+
+move indexed_move(const movebuffer *moves, board board, size_t index)
+{
+	if (index < moves->count) return moves->buffer[index];
+
+	bitboard pushes = moves->pawn_push;
+	for (index -= moves->count; index; index -= 1) pushes &= pushes - 1;
+
+	return pawn_push_move(board, ctz(pushes));
+}
+
+
+//  Writing a file. Records are written through stdio as they are added, only the block index is
+//  kept in memory (16 bytes per block).
+
+typedef struct {
+	FILE *out;
+	uint64_t offset, records, block_start;
+	pack_block *index;
+	size_t blocks, capacity;
+} pack_writer;
+
+
+bool open_pack_writer(const char *path, pack_writer *writer)
+{
+	*writer = (pack_writer) { fopen(path, "wb"), sizeof pack_magic, 0, 0, NULL, 0, 0 };
+	if (!writer->out) return false;
+
+	fwrite(pack_magic, 1, sizeof pack_magic, writer->out);
+	return true;
+}
+
+
+//  Add a record of a sequence of moves from a position, moves are given as in notation.h (a pawn
+//  push is a move of a pawn on the same file). Returns false if the board is not plausible (as the
+//  reader would reject it), a move is not legal, or there are too many of them, and then nothing is
+//  written.
+
+bool write_pack_record(pack_writer *writer, board board, bool white_to_move, const move *moves, size_t plies)
+{
+	if (plies > MAX_PACK_PLIES || !is_plausible_board(board)) return false;
+
+	uint64_t *words = malloc((plies + 1) * sizeof *words);
+	size_t count = 0;
+	uint64_t value = 0, radix = 1;
+
+	pack_record_header header = { board, white_to_move, plies, 0 };
+
+	for (size_t i = 0; i < plies; i += 1) {
+		movebuffer legal = generate_moves(board);
+		size_t n = count_legal_moves(&legal);
+		size_t index = move_index(&legal, board, moves[i]);
+
+		if (index >= n) {
+			free(words);
+			return false;
+		}
+
+		if (radix > UINT64_MAX / n) {
+			words[count++] = value;
+			value = 0, radix = 1;
+		}
+
+		value += index * radix;
+		radix *= n;
+		board = play_move(board, moves[i]);
+	}
+
+	if (radix > 1) words[count++] = value;
+	header.words = count;
+
+	// start a new block once the current one is full, records never cross blocks
+	if (writer->records == 0 || writer->offset - writer->block_start >= PACK_BLOCK_SIZE) {
+		if (writer->blocks == writer->capacity) {
+			writer->capacity = writer->capacity ? writer->capacity * 2 : 64;
+			writer->index = realloc(writer->index, writer->capacity * sizeof *writer->index);
+		}
+
+		writer->index[writer->blocks++] = (pack_block) { writer->offset, writer->records };
+		writer->block_start = writer->offset;
+	}
+
+	fwrite(&header, sizeof header, 1, writer->out);
+	fwrite(words, sizeof *words, count, writer->out);
+
+	writer->offset += sizeof header + count * sizeof *words;
+	writer->records += 1;
+
+	free(words);
+	return true;
+}
+
+
+// The index is aligned to 8 bytes, so that it can be read in place from the mapping
+
+bool close_pack_writer(pack_writer *writer)
+{
+	uint64_t zero = 0;
+	size_t padding = -writer->offset & 7;
+
+	fwrite(&zero, 1, padding, writer->out);
+	pack_footer footer = { writer->offset + padding, writer->blocks, writer->records, "MOVEPACK" };
+
+	fwrite(writer->index, sizeof *writer->index, writer->blocks, writer->out);
+	fwrite(&footer, sizeof footer, 1, writer->out);
+
+	bool ok = !ferror(writer->out);
+	ok &= (fclose(writer->out) == 0);
+
+	free(writer->index);
+	return ok;
+}
+
+
+//  Reading a file. The file is mapped into memory, and records are decoded in place. A cursor
+//  walks through the positions of a record, generating the legal moves of each position to decode
+//  the next move. Only the footer is trusted to be what the writer wrote: records that run past
+//  the end of the records, and moves past the words of their record, are treated as corrupt.
+
+typedef struct {
+	epd_file file;
+	const pack_block *index;
+	size_t blocks, records;
+	const char *end;        // the end of the records, where the index starts
+} pack_file;
+
+// A record in the mapping, neither the header nor the words are aligned
+typedef struct {
+	const pack_record_header *header;
+	const char *words, *end;
+} pack_record;
+
+typedef struct {
+	board board;
+	bool white_to_move;
+	size_t ply, plies;
+	move last;              // the move that led to the current position, 0 at the start
+
+	const char *next, *end; // the next word of digits, and the end of the words of the record
+	uint64_t value, radix;  // the digits left in the current word, and their range
+} pack_cursor;
+
+
+bool open_pack_file(const char *path, pack_file *pack)
+{
+	if (!open_epd_file(path, &pack->file)) return false;
+
+	epd_file file = pack->file;
+	pack_footer footer;
+
+	if (file.size < sizeof pack_magic + sizeof footer || memcmp(file.data, pack_magic, sizeof pack_magic) != 0)
+		goto invalid;
+
+	memcpy(&footer, file.data + file.size - sizeof footer, sizeof footer);
+
+	if (memcmp(footer.magic, pack_magic, sizeof pack_magic) != 0 || footer.index_offset % 8 != 0
+	 || footer.index_offset > file.size - sizeof footer
+	 || footer.blocks != (file.size - sizeof footer - footer.index_offset) / sizeof (pack_block)
+	 || (footer.records && !footer.blocks))
+		goto invalid;
+
+	pack->index = (const pack_block *) (file.data + footer.index_offset);
+	pack->blocks = footer.blocks;
+	pack->records = footer.records;
+	pack->end = file.data + footer.index_offset;
+	return true;
+
+invalid:
+	close_epd_file(&pack->file);
+	return false;
+}
+
+
+void close_pack_file(pack_file *pack)
+{
+	close_epd_file(&pack->file);
+}
+
+
+// The record at `data`, returns false if it doesn't fit in the records of the file, or if its
+// initial board is not plausible (see legal.h). The moves decoded from there are legal, so every
+// later position of the record is as safe.
+
+bool pack_record_at(const pack_file *pack, const char *data, pack_record *record)
+{
+	pack_record_header header;
+	const char *start = pack->file.data + sizeof pack_magic;
+
+	if (data < start || data > pack->end || (size_t) (pack->end - data) < sizeof header) return false;
+
+	memcpy(&header, data, sizeof header);
+	const char *words = data + sizeof header;
+
+	if ((size_t) (pack->end - words) / sizeof (uint64_t) < header.words) return false;
+	if (!is_plausible_board(header.board)) return false;
+
+	*record = (pack_record) { (const pack_record_header *) data, words, words + header.words * sizeof (uint64_t) };
+	return true;
+}
+
+
+const char *next_pack_record(pack_record record)
+{
+	return record.end;
+}
+
+
+// Find record `n` of the file (which must exist), by the block index and then skipping the records
+// before it in its block. Returns false if the file is corrupt.
+
+bool find_pack_record(const pack_file *pack, size_t n, pack_record *record)
+{
+	size_t low = 0, high = pack->blocks;
+
+	while (high - low > 1) {
+		size_t middle = (low + high) / 2;
+		if (pack->index[middle].first_record <= n) low = middle;
+		else high = middle;
+	}
+
+	if (pack->index[low].offset > (size_t) (pack->end - pack->file.data)) return false;
+	if (!pack_record_at(pack, pack->file.data + pack->index[low].offset, record)) return false;
+
+	for (size_t i = pack->index[low].first_record; i < n; i += 1)
+		if (!pack_record_at(pack, next_pack_record(*record), record)) return false;
+
+	return true;
+}
+
+
+pack_cursor open_pack_cursor(pack_record record)
+{
+	pack_record_header header;
+	memcpy(&header, record.header, sizeof header);
+
+	return (pack_cursor) { header.board, header.white_to_move, 0, header.plies, 0, record.words, record.end, 0, 1 };
+}
+
+
+// Advance to the next position of a record, returns false at the end of the record, or where it is
+// corrupt (moves past the end of the game, or past the words of the record)
+
+bool next_pack_position(pack_cursor *cursor)
+{
+	if (cursor->ply == cursor->plies) return false;
+
+	movebuffer moves = generate_moves(cursor->board);
+	size_t n = count_legal_moves(&moves);
+
+	if (n == 0) return false;
+
+	// the writer starts a new word at the first digit that doesn't fit in the current one
+	if (cursor->radix > UINT64_MAX / n) cursor->radix = 1;
+	if (cursor->radix == 1 && n > 1) {
+		if (cursor->next == cursor->end) return false;
+
+		memcpy(&cursor->value, cursor->next, sizeof cursor->value);
+		cursor->next += sizeof cursor->value;
+	}
+
+	size_t index = cursor->value % n;
+	cursor->value /= n;
+	cursor->radix *= n;
+
+	cursor->last = indexed_move(&moves, cursor->board, index);
+	cursor->board = play_move(cursor->board, cursor->last);
+	cursor->white_to_move = !cursor->white_to_move;
+	cursor->ply += 1;
+	return true;
+}
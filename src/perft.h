@@ -0,0 +1,324 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "hash.h"
+#include "movegen.h"
+
+
+// Count the leaf nodes of the legal move tree of a given depth. This is the standard test for
+// the correctness (and speed) of a move generator. Leaves are bulk-counted without generating
+// them. Note: the movebuffer lives in the stack frame of each call so every thread naturally gets
+// its own stack of buffers.
+
+size_t perft(board pos, unsigned depth)
+{
+	if (depth == 1) return count_moves(pos);
+	movebuffer moves = generate_moves(pos);
+
+	size_t total = 0;
+
+	for (size_t i = 0; i < moves.count; i += 1) {
+		board child = make_move(pos, moves.buffer[i]);
+		total += perft(child, depth - 1);
+	}
+
+	for bits(moves.pawn_push) {
+		board child = make_pawn_push(pos, ctz(moves.pawn_push));
+		total += perft(child, depth - 1);
+	}
+
+	return total;
+}
+
+
+//  Hashed perft. Subtree counts are cached in a table shared by all threads, without locks. Each
+//  entry is two 64 bit words, the packed data (node count and depth) and the hash xor'ed with the
+//  data. A torn write from two racing threads then fails the xor check when probed, and is
+//  treated as a miss instead of returning a wrong count. Buckets hold two entries, one replaced
+//  only by deeper subtrees and one that is always replaced.
+//
+//  A symmetric table shares its entries between mirror images (see symmetric_hash_board). There is
+//  nothing to collapse among the moves of a single position, as the kings are never on their own
+//  mirror squares, so no position is its own mirror image. Colour-flipped positions always share
+//  their entries, as boards are stored from the side to move.
+
+typedef struct { uint64_t key, data; } perft_entry;
+typedef struct { perft_entry *entries; size_t mask; bool symmetric; } perft_table;
+
+#define PERFT_DATA(nodes, depth)  ((uint64_t)(nodes) << 8 | (depth))
+#define PERFT_NODES(data)         ((data) >> 8)
+#define PERFT_DEPTH(data)         ((data) & 0xff)
+
+
+// Allocate a table of (at most) the given size in megabytes, rounded down to a power of two.
+
+perft_table create_perft_table(size_t megabytes)
+{
+	size_t count = 2;
+	while (count * 2 * sizeof(perft_entry) <= (megabytes << 20)) count *= 2;
+
+	perft_table table = { calloc(count, sizeof(perft_entry)), count - 2, false };
+	return table;
+}
+
+
+void clear_perft_table(perft_table *table)
+{
+	memset(table->entries, 0, (table->mask + 2) * sizeof(perft_entry));
+}
+
+
+void free_perft_table(perft_table *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+}
+
+
+bool probe_perft_table(perft_table *table, uint64_t hash, unsigned depth, size_t *nodes)
+{
+	perft_entry *bucket = &table->entries[hash & table->mask];
+
+	for (unsigned i = 0; i < 2; i += 1) {
+		uint64_t key  = __atomic_load_n(&bucket[i].key,  __ATOMIC_RELAXED);
+		uint64_t data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+
+		if ((key ^ data) == hash && PERFT_DEPTH(data) == depth) {
+			*nodes = PERFT_NODES(data);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+void store_perft_table(perft_table *table, uint64_t hash, unsigned depth, size_t nodes)
+{
+	perft_entry *bucket = &table->entries[hash & table->mask];
+	uint64_t data = PERFT_DATA(nodes, depth);
+
+	unsigned i = (depth >= PERFT_DEPTH(__atomic_load_n(&bucket[0].data, __ATOMIC_RELAXED))) ? 0 : 1;
+
+	__atomic_store_n(&bucket[i].key,  hash ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&bucket[i].data, data,        __ATOMIC_RELAXED);
+}
+
+
+size_t hashed_perft(perft_table *table, board pos, unsigned depth)
+{
+	if (depth == 1) return count_moves(pos);
+
+	uint64_t hash = table->symmetric ? symmetric_hash_board(pos) : hash_board(pos);
+	size_t total = 0;
+
+	if (probe_perft_table(table, hash, depth, &total))
+		return total;
+
+	movebuffer moves = generate_moves(pos);
+
+	for (size_t i = 0; i < moves.count; i += 1) {
+		board child = make_move(pos, moves.buffer[i]);
+		total += hashed_perft(table, child, depth - 1);
+	}
+
+	for bits(moves.pawn_push) {
+		board child = make_pawn_push(pos, ctz(moves.pawn_push));
+		total += hashed_perft(table, child, depth - 1);
+	}
+
+	store_perft_table(table, hash, depth, total);
+	return total;
+}
+
+
+//  Parallel perft. The tree is split below the root into independent tasks (a position and the
+//  remaining depth), and if the root is too narrow to keep every thread busy it is split further
+//  until there are enough tasks. Each worker owns a contiguous range of the task array as its
+//  deque: it pops tasks from the front of its own range, and when it runs dry it steals the back
+//  half of the largest remaining range of another worker. Tasks are whole subtrees, so the locks
+//  guarding the deques are taken rarely and are never contended for long.
+
+#define PERFT_TASKS_PER_THREAD 32   // minimum number of tasks per thread before we stop splitting
+#define PERFT_MIN_TASK_DEPTH   3    // don't split into tasks that are too small to be worth it
+
+typedef struct { board pos; unsigned depth; } perft_task;
+typedef struct { pthread_mutex_t lock; size_t head, tail; } perft_deque;
+
+// Runs a task, adding its results to the accumulator of the thread that runs it
+typedef void (*perft_task_runner)(void *context, perft_task task, void *accumulator);
+
+typedef struct {
+	perft_task *tasks;
+	perft_deque *deques;
+	perft_task_runner run;
+	void *context;
+	unsigned threads;
+} perft_pool;
+
+typedef struct { perft_pool *pool; unsigned id; void *accumulator; } perft_worker;
+
+
+// Split every task in the list one ply deeper, returns the new number of tasks. Leaf counts are
+// additive, so the order of the tasks does not matter.
+
+size_t split_perft_tasks(perft_task **tasks, size_t count)
+{
+	perft_task *split = malloc(count * MAX_MOVES * sizeof *split);
+	size_t total = 0;
+
+	for (size_t i = 0; i < count; i += 1) {
+		perft_task task = (*tasks)[i];
+		movebuffer moves = generate_moves(task.pos);
+
+		for (size_t j = 0; j < moves.count; j += 1)
+			split[total++] = (perft_task) { make_move(task.pos, moves.buffer[j]), task.depth - 1 };
+
+		for bits(moves.pawn_push)
+			split[total++] = (perft_task) { make_pawn_push(task.pos, ctz(moves.pawn_push)), task.depth - 1 };
+	}
+
+	free(*tasks);
+	*tasks = realloc(split, (total ? total : 1) * sizeof *split);
+	return total;
+}
+
+
+bool pop_perft_task(perft_deque *deque, perft_task *tasks, perft_task *task)
+{
+	pthread_mutex_lock(&deque->lock);
+	bool ok = deque->head < deque->tail;
+	if (ok) *task = tasks[deque->head++];
+	pthread_mutex_unlock(&deque->lock);
+
+	return ok;
+}
+
+
+// Steal the back half of the fullest deque of another worker into our own (empty) deque.
+
+bool steal_perft_tasks(perft_pool *pool, unsigned id)
+{
+	for (;;) {
+		unsigned victim = id;
+		size_t most = 0;
+
+		for (unsigned i = 0; i < pool->threads; i += 1) {
+			perft_deque *deque = &pool->deques[i];
+
+			pthread_mutex_lock(&deque->lock);
+			size_t size = deque->tail - deque->head;
+			pthread_mutex_unlock(&deque->lock);
+
+			if (i != id && size > most) victim = i, most = size;
+		}
+
+		if (victim == id) return false;
+
+		perft_deque *from = &pool->deques[victim];
+		perft_deque *to   = &pool->deques[id];
+
+		pthread_mutex_lock(&from->lock);
+		size_t size = from->tail - from->head;
+		size_t take = (size + 1) / 2;
+		size_t start = from->tail -= take;
+		pthread_mutex_unlock(&from->lock);
+
+		// The victim may have emptied its deque since we looked, so just try again
+		if (take == 0) continue;
+
+		pthread_mutex_lock(&to->lock);
+		to->head = start;
+		to->tail = start + take;
+		pthread_mutex_unlock(&to->lock);
+
+		return true;
+	}
+}
+
+
+void *perft_worker_main(void *arg)
+{
+	perft_worker *worker = arg;
+	perft_pool *pool = worker->pool;
+	perft_task task;
+
+	do {
+		while (pop_perft_task(&pool->deques[worker->id], pool->tasks, &task))
+			pool->run(pool->context, task, worker->accumulator);
+	}
+	while (steal_perft_tasks(pool, worker->id));
+
+	return NULL;
+}
+
+
+// Split a tree into tasks and run them over a number of threads. Each thread adds its results to
+// its own accumulator, `accumulators` holds one of `size` bytes per thread, for the caller to sum.
+
+void run_perft_pool(board pos, unsigned depth, unsigned threads, perft_task_runner run, void *context,
+                    void *accumulators, size_t size)
+{
+	perft_task *tasks = malloc(sizeof *tasks);
+	tasks[0] = (perft_task) { pos, depth };
+	size_t count = 1;
+
+	while (count && count < (size_t)threads * PERFT_TASKS_PER_THREAD && tasks[0].depth > PERFT_MIN_TASK_DEPTH)
+		count = split_perft_tasks(&tasks, count);
+
+	perft_pool pool = { tasks, calloc(threads, sizeof(perft_deque)), run, context, threads };
+	perft_worker *workers = calloc(threads, sizeof *workers);
+	pthread_t *handles = calloc(threads, sizeof *handles);
+
+	// Deal the tasks out in equal contiguous ranges, stealing evens out the rest
+	for (unsigned i = 0; i < threads; i += 1) {
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+		pool.deques[i].head = count * i / threads;
+		pool.deques[i].tail = count * (i + 1) / threads;
+		workers[i] = (perft_worker) { &pool, i, (char *) accumulators + i * size };
+	}
+
+	for (unsigned i = 1; i < threads; i += 1)
+		pthread_create(&handles[i], NULL, perft_worker_main, &workers[i]);
+
+	perft_worker_main(&workers[0]);
+
+	for (unsigned i = 1; i < threads; i += 1)
+		pthread_join(handles[i], NULL);
+
+	for (unsigned i = 0; i < threads; i += 1)
+		pthread_mutex_destroy(&pool.deques[i].lock);
+
+	free(handles);
+	free(workers);
+	free(pool.deques);
+	free(tasks);
+}
+
+
+void count_perft_task(void *table, perft_task task, void *nodes)
+{
+	*(size_t *) nodes += table ? hashed_perft(table, task.pos, task.depth) : perft(task.pos, task.depth);
+}
+
+
+// Run perft over a number of threads, the table is optional and may be NULL for an uncached perft.
+
+size_t parallel_perft(board pos, unsigned depth, unsigned threads, perft_table *table)
+{
+	if (threads <= 1 || depth < PERFT_MIN_TASK_DEPTH)
+		return table ? hashed_perft(table, pos, depth) : perft(pos, depth);
+
+	size_t *nodes = calloc(threads, sizeof *nodes);
+	run_perft_pool(pos, depth, threads, count_perft_task, table, nodes, sizeof *nodes);
+
+	size_t total = 0;
+	for (unsigned i = 0; i < threads; i += 1) total += nodes[i];
+
+	free(nodes);
+	return total;
+}
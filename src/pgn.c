@@ -0,0 +1,212 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bitbase.h"
+#include "pgn.h"
+#include "timer.h"
+
+//  Replay and validate every game of a PGN file on all cores. The file is split into chunks that
+//  the threads take in turn, and each thread replays the games that start in its chunk, so memory
+//  use doesn't depend on the size of the file: the pages of a chunk are dropped from the mapping
+//  once it is done (they are clean, and would just be read again from the page cache).
+//
+//  One line is written per game, and with -p one per position, as tab-separated fields:
+//
+//    offset  OK     plies  key   result
+//    offset  ERROR  ply    -     message
+//    offset  POS    ply    hash  FEN
+//
+//  where offset is the byte offset of the game in the file, which identifies it (games are written
+//  in the order they finish, sort on the offset to get them in file order). The key of a game is
+//  the same for games with the same moves from the same position, so duplicates can be found by
+//  sorting on it.
+
+#define PGN_CHUNK_SIZE  (1 << 20)
+#define PGN_BUFFER_SIZE (1 << 16)
+
+typedef struct {
+	epd_file file;
+	size_t chunks, next;
+	bool positions;
+	pthread_mutex_t output;
+
+	size_t games, errors, plies;
+} pgn_runner;
+
+typedef struct {
+	pgn_runner *runner;
+	size_t offset, used, ply;
+	char buffer[PGN_BUFFER_SIZE];
+	game state;
+} pgn_worker;
+
+
+// Output is buffered by each thread and written a buffer at a time, so lines are never split
+
+void flush_output(pgn_worker *worker)
+{
+	pthread_mutex_lock(&worker->runner->output);
+	fwrite(worker->buffer, 1, worker->used, stdout);
+	pthread_mutex_unlock(&worker->runner->output);
+
+	worker->used = 0;
+}
+
+
+#define MAX_OUTPUT_LINE (64 + MAX_FEN_LENGTH)
+
+char *output_line(pgn_worker *worker)
+{
+	if (PGN_BUFFER_SIZE - worker->used < MAX_OUTPUT_LINE) flush_output(worker);
+	return worker->buffer + worker->used;
+}
+
+
+void write_position(void *context, const game *state, move move)
+{
+	pgn_worker *worker = context;
+	worker->ply = move ? worker->ply + 1 : 0; // the initial position has no move
+
+	char *line = output_line(worker);
+
+	int n = sprintf(line, "%zu\tPOS\t%zu\t%016llx\t", worker->offset, worker->ply, (unsigned long long) state->hash);
+	n += write_fen(line + n, state->board, state->white_to_move, state->halfmove, state->fullmove);
+	line[n++] = '\n';
+
+	worker->used += n;
+}
+
+
+void replay_chunk(pgn_worker *worker, size_t chunk)
+{
+	pgn_runner *runner = worker->runner;
+	epd_file file = runner->file;
+	const char *file_end = file.data + file.size;
+
+	size_t begin = chunk * PGN_CHUNK_SIZE;
+	size_t end = (begin + PGN_CHUNK_SIZE < file.size) ? begin + PGN_CHUNK_SIZE : file.size;
+	const char *chunk_end = file.data + end;
+
+	size_t games = 0, errors = 0, plies = 0;
+	const char *start = next_pgn_game(file.data, epd_line_start(file, begin), file_end);
+	const char *first_game = start;
+
+	// the games that start in the chunk, the last of them usually ends in the next one
+	while (start < chunk_end) {
+		const char *newline = memchr(start, '\n', file_end - start);
+		const char *game_end = newline ? next_pgn_game(file.data, newline + 1, file_end) : file_end;
+
+		worker->offset = start - file.data;
+		pgn_result result = replay_pgn_game(read_pgn_tags(start, game_end), &worker->state,
+		                                    runner->positions ? write_position : NULL, worker);
+
+		char *line = output_line(worker);
+
+		if (result.ok)
+			worker->used += sprintf(line, "%zu\tOK\t%zu\t%016llx\t%s\n", worker->offset, result.plies, (unsigned long long) result.key, result.result);
+		else
+			worker->used += sprintf(line, "%zu\tERROR\t%zu\t-\t%s\n", worker->offset, result.plies, result.error);
+
+		games += 1, errors += !result.ok, plies += result.plies;
+		start = game_end;
+	}
+
+	// Drop the whole pages from the first game of the chunk up to the end of the chunk. The last game
+	// of the previous chunk ends before the first one, and may still be replaying on another thread.
+	// The mapping is clean and read-only, so a page that is read again anyway (like the start of the
+	// line that the next chunk looks back to) only costs a fault back in from the page cache.
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t first = ((uintptr_t) first_game + page - 1) & ~(page - 1);
+	uintptr_t last = ((uintptr_t) start < (uintptr_t) chunk_end ? (uintptr_t) start : (uintptr_t) chunk_end) & ~(page - 1);
+	if (last > first) madvise((void *) first, last - first, MADV_DONTNEED);
+
+	__atomic_fetch_add(&runner->games, games, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&runner->errors, errors, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&runner->plies, plies, __ATOMIC_RELAXED);
+}
+
+
+void *pgn_worker_main(void *arg)
+{
+	pgn_worker *worker = arg;
+
+	for (;;) {
+		size_t chunk = __atomic_fetch_add(&worker->runner->next, 1, __ATOMIC_RELAXED);
+		if (chunk >= worker->runner->chunks) break;
+
+		replay_chunk(worker, chunk);
+	}
+
+	flush_output(worker);
+	return NULL;
+}
+
+
+//  usage: pgn [-t threads] [-p] file.pgn
+//    -t  number of threads (defaults to all available cores)
+//    -p  write every position of each game as well
+//
+//  Exits with status 1 if any game is invalid.
+
+int main(int argc, char **argv)
+{
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned threads = (cores > 0) ? cores : 1;
+	bool positions = false;
+
+	for (int opt; (opt = getopt(argc, argv, "t:p")) != -1;) {
+		switch (opt) {
+			case 't': threads = strtoul(optarg, NULL, 10); break;
+			case 'p': positions = true; break;
+			default : fprintf(stderr, "usage: %s [-t threads] [-p] file.pgn\n", argv[0]); return 1;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "usage: %s [-t threads] [-p] file.pgn\n", argv[0]);
+		return 1;
+	}
+
+	if (threads == 0) threads = 1;
+
+	epd_file file;
+
+	if (!open_epd_file(argv[optind], &file)) {
+		fprintf(stderr, "could not read %s\n", argv[optind]);
+		return 1;
+	}
+
+	pgn_runner runner = { file, (file.size + PGN_CHUNK_SIZE - 1) / PGN_CHUNK_SIZE, 0, positions, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+
+	pgn_worker *workers = malloc(threads * sizeof *workers);
+	pthread_t *handles = calloc(threads, sizeof *handles);
+
+	double t1 = wall_seconds();
+
+	for (unsigned i = 0; i < threads; i += 1) {
+		workers[i].runner = &runner;
+		workers[i].used = 0;
+		if (i) pthread_create(&handles[i], NULL, pgn_worker_main, &workers[i]);
+	}
+
+	pgn_worker_main(&workers[0]);
+
+	for (unsigned i = 1; i < threads; i += 1)
+		pthread_join(handles[i], NULL);
+
+	double t2 = wall_seconds();
+
+	fprintf(stderr, "%zu games, %zu invalid, %zu plies in %.3fs (%.0f games/s, %.1f MB/s)\n",
+	        runner.games, runner.errors, runner.plies, t2 - t1, runner.games / (t2 - t1), file.size / (t2 - t1) / 1e6);
+
+	free(handles);
+	free(workers);
+	close_epd_file(&file);
+
+	return runner.errors ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "epd.h"
+#include "game.h"
+#include "legal.h"
+#include "notation.h"
+
+//  Reader for PGN files of many games. Like epd.h the file is mapped into memory and split into
+//  parts at game boundaries, so that any number of threads can replay games from the same mapping
+//  without copying them. A game starts at the first tag of its tag section, that is a line starting
+//  with '[' that doesn't follow another tag line, and ends where the next game starts.
+//
+//  Games are replayed by parsing each SAN move against the legal moves of the position, so that a
+//  game is only accepted if every move is legal and unambiguous.
+//    (Reference: https://www.chessprogramming.org/Portable_Game_Notation)
+
+#define MAX_PGN_TOKEN 16
+
+typedef struct {
+	const char *start, *movetext, *end;     // the tag section is from start to movetext
+	const char *fen;                        // the value of the FEN tag if there is one, else NULL
+	size_t fen_length;
+} pgn_game;
+
+//  The outcome of replaying a game. `key` identifies the sequence of positions of the game, for
+//  finding duplicate games, and `result` is the game termination marker (1-0, 0-1, 1/2-1/2 or *).
+
+typedef struct {
+	bool ok;
+	size_t plies;
+	uint64_t key;
+	char result[8];
+	char error[64];
+} pgn_result;
+
+
+// The start of the line before the one at `line`, which must not be the first line of the data
+
+const char *previous_line(const char *data, const char *line)
+{
+	const char *c = line - 1;
+	while (c > data && c[-1] != '\n') c -= 1;
+	return c;
+}
+
+
+//  Find the start of the first game at or after `from` (the start of a line) and before `end`,
+//  or return `end` if there is none. `data` is the start of the file, to look at the line before.
+
+const char *next_pgn_game(const char *data, const char *from, const char *end)
+{
+	bool after_tag = (from > data) && previous_line(data, from)[0] == '[';
+
+	while (from < end) {
+		if (from[0] == '[' && !after_tag) return from;
+
+		after_tag = (from[0] == '[');
+
+		const char *newline = memchr(from, '\n', end - from);
+		from = newline ? newline + 1 : end;
+	}
+
+	return end;
+}
+
+
+//  Read the tag section of a game from `start` (the game ends at `end`). Only the FEN tag is kept,
+//  as it is all that is needed to replay the game, other tags are skipped.
+
+pgn_game read_pgn_tags(const char *start, const char *end)
+{
+	pgn_game game = { start, end, end, NULL, 0 };
+	const char *line = start;
+
+	while (line < end && line[0] == '[') {
+		const char *newline = memchr(line, '\n', end - line);
+		const char *next = newline ? newline + 1 : end;
+
+		if (next - line > 6 && memcmp(line, "[FEN \"", 6) == 0) {
+			const char *quote = memchr(line + 6, '"', next - line - 6);
+
+			if (quote) {
+				game.fen = line + 6;
+				game.fen_length = quote - game.fen;
+			}
+		}
+
+		line = next;
+	}
+
+	game.movetext = line;
+	return game;
+}
+
+
+//  Read the next token of the movetext from `*text`, skipping white space, comments ({...} and
+//  ; to the end of the line), variations (...) and numeric annotations ($n). Returns the length of
+//  the token, which is 0 at the end of the game.
+
+size_t next_pgn_token(const char **text, const char *end, const char **token)
+{
+	const char *c = *text;
+
+	while (c < end) {
+		switch (*c) {
+			case ' ': case '\t': case '\r': case '\n': case ')':
+				c += 1;
+				continue;
+
+			case '{': {
+				const char *close = memchr(c, '}', end - c);
+				c = close ? close + 1 : end;
+				continue;
+			}
+
+			case ';': case '%': {
+				const char *newline = memchr(c, '\n', end - c);
+				c = newline ? newline + 1 : end;
+				continue;
+			}
+
+			case '(': {
+				// variations nest, and may contain comments with parentheses in them
+				unsigned depth = 0;
+
+				for (; c < end; c += 1) {
+					if (*c == '{') {
+						const char *close = memchr(c, '}', end - c);
+						c = close ? close : end - 1;
+					}
+
+					else if (*c == '(') depth += 1;
+					else if (*c == ')' && --depth == 0) break;
+				}
+
+				c += (c < end);
+				continue;
+			}
+
+			case '$':
+				for (c += 1; c < end && '0' <= *c && *c <= '9'; c += 1);
+				continue;
+		}
+
+		break;
+	}
+
+	*token = c;
+
+	while (c < end && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n' && *c != '{' && *c != '(' && *c != ')' && *c != ';')
+		c += 1;
+
+	*text = c;
+	return c - *token;
+}
+
+
+bool is_pgn_result(const char *token, size_t length)
+{
+	return (length == 1 && token[0] == '*')
+	    || (length == 3 && (memcmp(token, "1-0", 3) == 0 || memcmp(token, "0-1", 3) == 0))
+	    || (length == 7 && memcmp(token, "1/2-1/2", 7) == 0);
+}
+
+
+//  Replay a game from its initial position (the FEN tag, which must be a plausible board, or the
+//  standard starting position), and call `visit` with every position of the game and the move that
+//  led to it (0 for the initial position), if it is not NULL. Moves are never unmade, so once the
+//  history is full it is trimmed to the positions since the last irreversible move, and games of
+//  any length can be replayed. As the history is trimmed, the ply of the game is the count of moves
+//  visited, not the ply of `state`.
+
+pgn_result replay_pgn_game(pgn_game pgn, game *state, void (*visit)(void *, const game *, move), void *context)
+{
+	pgn_result result = { false, 0, 0, "", "" };
+
+	if (pgn.fen) {
+		char fen[MAX_EPD_LINE];
+		size_t length = (pgn.fen_length < MAX_EPD_LINE) ? pgn.fen_length : MAX_EPD_LINE - 1;
+
+		memcpy(fen, pgn.fen, length);
+		fen[length] = '\0';
+
+		if (!init_game_fen(state, fen) || !is_plausible_board(state->board)) {
+			snprintf(result.error, sizeof result.error, "invalid FEN tag");
+			return result;
+		}
+	}
+
+	else init_game(state, BOARD_STARTPOS, true, 0, 1);
+
+	// the key mixes the hash of every position in order, so transpositions give different keys
+	result.key = state->hash;
+	if (visit) visit(context, state, 0);
+
+	const char *text = pgn.movetext, *token;
+	size_t length;
+
+	while ((length = next_pgn_token(&text, pgn.end, &token))) {
+		if (is_pgn_result(token, length)) {
+			memcpy(result.result, token, length);
+			result.result[length] = '\0';
+			break;
+		}
+
+		// skip move numbers, which may be written without a space before the move ("12.e4")
+		size_t skip = 0;
+		while (skip < length && '0' <= token[skip] && token[skip] <= '9') skip += 1;
+
+		if (skip < length && token[skip] == '.') {
+			while (skip < length && token[skip] == '.') skip += 1;
+			token += skip, length -= skip;
+			if (length == 0) continue;
+		}
+
+		if (length >= MAX_PGN_TOKEN) {
+			snprintf(result.error, sizeof result.error, "ply %zu: invalid move %.*s", result.plies + 1, MAX_PGN_TOKEN, token);
+			return result;
+		}
+
+		char san[MAX_PGN_TOKEN];
+		memcpy(san, token, length);
+		san[length] = '\0';
+
+		bool ok;
+		movebuffer moves = generate_moves(state->board);
+		move move = parse_san(san, state->board, &moves, state->white_to_move, &ok);
+
+		if (!ok) {
+			snprintf(result.error, sizeof result.error, "ply %zu: illegal or ambiguous move %s", result.plies + 1, san);
+			return result;
+		}
+
+		if (state->ply == MAX_GAME_PLIES) trim_game_history(state);
+
+		if (is_pawn_push(move)) make_game_pawn_push(state, M_DEST(move));
+		else make_game_move(state, move);
+
+		result.plies += 1;
+		result.key = (result.key ^ state->hash) * 0x9e3779b97f4a7c15;
+		if (visit) visit(context, state, move);
+	}
+
+	if (!result.result[0]) {
+		snprintf(result.error, sizeof result.error, "ply %zu: missing game termination", result.plies + 1);
+		return result;
+	}
+
+	result.ok = true;
+	return result;
+}
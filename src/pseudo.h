@@ -0,0 +1,141 @@
+#pragma once
+
+#include <assert.h>
+
+#include "board.h"
+#include "legal.h"
+#include "movegen.h"
+
+//  Pseudo-legal move generation. generate_moves pays for full legality up front: the squares the
+//  enemy attacks, the pinned pieces and the pinned en-passant test. A search that cuts off after
+//  the first few moves never plays most of them, so this mode generates every move of the pieces
+//  without looking at the enemy at all, and leaves it to is_legal_after to reject the moves that
+//  leave the king in check, once they are made. Only castling is checked as it is generated, as
+//  moving through check can't be seen from the position after the move.
+//
+//  There are more pseudo-legal moves than legal ones (king moves into check, moves of pinned
+//  pieces), so they don't fit in a movebuffer in the most extreme positions. Pawn pushes are kept
+//  in the pawn_push mask as usual, and the buffer is sized from the most moves each piece can have
+//  on an empty board: a queen 27, a rook 14, a bishop 13, a knight 8, and a king 8 and 2 castles.
+//  A pawn that is not promoted is worth less than a queen (at most 3 destinations, 4 promotions
+//  each), so the most a side can have is nine queens and the other original pieces, 323 moves.
+//
+//  Generating the moves is about a quarter faster than generate_moves, but writing out the moves
+//  is most of the cost of either, and every move that is searched then pays for is_legal_after. In
+//  the alpha-beta workload of bench.c the two end up within a few percent of each other, and in
+//  perft, which counts the leaves without making them, pseudo-legal moves are much slower.
+
+#define MAX_PSEUDO_MOVES (9*27 + 2*14 + 2*13 + 2*8 + 8 + 2)
+typedef struct { bitboard pawn_push; size_t count; move buffer[MAX_PSEUDO_MOVES]; } pseudo_movebuffer;
+
+
+void append_pseudo_moves(pseudo_movebuffer *moves, square init, bitboard dests, piecetype piece)
+{
+	assert(moves->count + popcnt(dests) <= MAX_PSEUDO_MOVES);
+	for bits(dests) moves->buffer[moves->count++] = M(init, ctz(dests), piece);
+}
+
+
+void append_pawn_moves(pseudo_movebuffer *moves, bitboard dests, square direction)
+{
+	bitboard promotions = dests & RANK8;
+	dests &= ~RANK8;
+
+	assert(moves->count + 4 * popcnt(promotions) + popcnt(dests) <= MAX_PSEUDO_MOVES);
+
+	for bits(promotions) {
+		square dest = ctz(promotions), init = dest - direction;
+
+		moves->buffer[moves->count++] = M(init, dest, KNIGHT);
+		moves->buffer[moves->count++] = M(init, dest, BISHOP);
+		moves->buffer[moves->count++] = M(init, dest, ROOK);
+		moves->buffer[moves->count++] = M(init, dest, QUEEN);
+	}
+
+	for bits(dests) moves->buffer[moves->count++] = M(ctz(dests) - direction, ctz(dests), PAWN);
+}
+
+
+// The moves of every piece of a type, castles move as rooks
+
+void append_piece_moves(pseudo_movebuffer *moves, board board, piecetype piece, bitboard targets)
+{
+	bitboard occ = occupied(board);
+	bitboard pieces = extract(board, piece) & board.white & occ;
+
+	for bits(pieces) {
+		square init = ctz(pieces);
+		append_pseudo_moves(moves, init, generic_attacks(piece, init, occ) & targets, piece);
+	}
+}
+
+
+void generate_pseudo_moves(pseudo_movebuffer *moves, board board)
+{
+	bitboard occ     = occupied(board);
+	bitboard ours    = board.white & occ;
+	bitboard targets = ~ours;
+	bitboard enemy   = (occ &~ board.white) | (board.white &~ occ); // with the en-passant square
+
+	bitboard pawns = extract(board, PAWN) & ours;
+	bitboard single_move = north(pawns) &~ occ;
+
+	moves->count = 0;
+	moves->pawn_push = (single_move &~ RANK8) | (north(single_move & RANK3) &~ occ);
+
+	append_pawn_moves(moves, single_move & RANK8, N);
+	append_pawn_moves(moves, north(east(pawns)) & enemy, N+E);
+	append_pawn_moves(moves, north(west(pawns)) & enemy, N+W);
+
+	append_piece_moves(moves, board, KNIGHT, targets);
+	append_piece_moves(moves, board, BISHOP, targets);
+	append_piece_moves(moves, board, ROOK,   targets);
+	append_piece_moves(moves, board, QUEEN,  targets);
+
+	square king = ctz(extract(board, KING) & ours);
+	append_pseudo_moves(moves, king, king_attacks[king] & targets, KING);
+
+	// is_legal_castling looks for the castle and for attacks on the path of the king
+	if (extract(board, CASTLE) & (1 << A1 | 1 << H1)) {
+		move queenside = M(E1, C1, KING) | M_CASTLING, kingside = M(E1, G1, KING) | M_CASTLING;
+		assert(moves->count + 2 <= MAX_PSEUDO_MOVES);
+
+		if (is_legal_castling(board, queenside)) moves->buffer[moves->count++] = queenside;
+		if (is_legal_castling(board, kingside))  moves->buffer[moves->count++] = kingside;
+	}
+}
+
+
+//  Whether the move that led to a position was legal, that is, the king of the side that moved
+//  (the enemy, after the board is flipped) is not attacked by the side to move.
+
+bool is_legal_after(board child)
+{
+	bitboard occ = occupied(child);
+	square king = ctz(extract(child, KING) & occ &~ child.white);
+
+	return !(attackers_to(child, king, occ) & child.white & occ);
+}
+
+
+// perft over pseudo-legal moves, which must give the same counts as perft
+
+size_t pseudo_perft(board pos, unsigned depth)
+{
+	pseudo_movebuffer moves;
+	generate_pseudo_moves(&moves, pos);
+
+	size_t total = 0;
+
+	for (size_t i = 0; i < moves.count; i += 1) {
+		board child = make_move(pos, moves.buffer[i]);
+		if (is_legal_after(child)) total += (depth == 1) ? 1 : pseudo_perft(child, depth - 1);
+	}
+
+	for bits(moves.pawn_push) {
+		board child = make_pawn_push(pos, ctz(moves.pawn_push));
+		if (is_legal_after(child)) total += (depth == 1) ? 1 : pseudo_perft(child, depth - 1);
+	}
+
+	return total;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "board.h"
+#include "legal.h"
+#include "movegen.h"
+#include "notation.h"
+#include "pseudo.h"
+#include "see.h"
+
+//  An alpha-beta search to a fixed depth followed by a quiescence search of captures, with material
+//  as the evaluation and captures searched first (the most valuable victim by the least valuable
+//  piece). Moves are picked one at a time in order, so with pseudo-legal moves only the moves that
+//  are searched are tested for legality. With staged moves (see movegen.h) the quiescence search
+//  only generates the captures stage, and never pays for the quiet moves. The order doesn't depend
+//  on the order the moves are generated in (ties are broken by the move itself), so all of the
+//  generators search the same tree. It is the search workload of bench.c, and tests.c checks that
+//  every generator gives the same results with it.
+
+enum alphabeta_mode { MOVES_FULL, MOVES_STAGED, MOVES_PSEUDO };
+
+#define ALPHABETA_DEPTH 6
+#define MATE_SCORE      100000
+#define CAPTURE_KEY     (1u << 16)
+
+int material(board pos)
+{
+	bitboard occ = occupied(pos);
+	int score = 0;
+
+	for (piecetype piece = PAWN; piece < KING; piece += 1) {
+		bitboard pieces = (piece == ROOK) ? pos.x &~ pos.y & pos.z : extract(pos, piece); // without the castles
+		score += see_values[piece] * (popcnt(pieces & pos.white) - popcnt(pieces & occ &~ pos.white));
+	}
+
+	return score;
+}
+
+
+uint32_t order_key(board pos, move move)
+{
+	if (!(occupied(pos) >> M_DEST(move) & 1)) return move;
+
+	int victim = see_values[piece_on(pos, M_DEST(move))];
+	return (uint32_t) (victim * 8 + KING - piece_on(pos, M_INIT(move))) * CAPTURE_KEY | move;
+}
+
+
+int alphabeta(board pos, int depth, int alpha, int beta, enum alphabeta_mode mode, size_t *nodes)
+{
+	bool quiescence = depth <= 0;
+	*nodes += 1;
+
+	if (quiescence) {
+		int score = material(pos);
+
+		if (score >= beta) return beta;
+		if (score > alpha) alpha = score;
+	}
+
+	move list[MAX_PSEUDO_MOVES];
+	uint32_t keys[MAX_PSEUDO_MOVES];
+	size_t count = 0;
+	bitboard pushes;
+
+	if (mode == MOVES_PSEUDO) {
+		pseudo_movebuffer moves;
+		generate_pseudo_moves(&moves, pos);
+
+		memcpy(list, moves.buffer, moves.count * sizeof *list);
+		count = moves.count, pushes = moves.pawn_push;
+	}
+
+	// the first stage is either the captures, or every move when in check
+	else if (mode == MOVES_STAGED && quiescence) {
+		move_stages stages;
+		movebuffer moves;
+
+		init_move_stages(&stages, pos);
+		next_move_stage(&stages, &moves);
+
+		memcpy(list, moves.buffer, moves.count * sizeof *list);
+		count = moves.count, pushes = moves.pawn_push;
+	}
+
+	else {
+		movebuffer moves = generate_moves(pos);
+
+		memcpy(list, moves.buffer, moves.count * sizeof *list);
+		count = moves.count, pushes = moves.pawn_push;
+	}
+
+	for bits(pushes) list[count++] = pawn_push_move(pos, ctz(pushes));
+	for (size_t i = 0; i < count; i += 1) keys[i] = order_key(pos, list[i]);
+
+	bool any = false;
+
+	for (size_t i = 0; i < count; i += 1) {
+		size_t best = i;
+
+		for (size_t j = i + 1; j < count; j += 1)
+			if (keys[j] > keys[best]) best = j;
+
+		// the quiescence search stops at the first move that isn't a capture
+		if (quiescence && keys[best] < CAPTURE_KEY) break;
+
+		move move = list[best];
+		list[best] = list[i], keys[best] = keys[i];
+
+		board child = play_move(pos, move);
+		if (mode == MOVES_PSEUDO && !is_legal_after(child)) continue;
+
+		int score = -alphabeta(child, depth - 1, -beta, -alpha, mode, nodes);
+		any = true;
+
+		if (score >= beta) return beta;
+		if (score > alpha) alpha = score;
+	}
+
+	if (!any && !quiescence) {
+		bitboard occ = occupied(pos);
+		square king = ctz(extract(pos, KING) & pos.white);
+
+		return (attackers_to(pos, king, occ) & occ &~ pos.white) ? -MATE_SCORE : 0;
+	}
+
+	return alpha;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "board.h"
+#include "legal.h"
+#include "movegen.h"
+
+//  Static exchange evaluation: the material won or lost by a sequence of captures on the
+//  destination square of a move, where both sides always recapture with their least valuable
+//  attacker and may stop capturing whenever it would lose material. It uses the attack tables of
+//  the move generator through attackers_to, and sliders hidden behind a piece that captures (on
+//  the same line) are found by looking up the bishop and rook attacks again without it.
+//
+//  Pins are ignored, as is usual for SEE, and so are promotions during the exchange (but not a
+//  promotion by the move itself). Castling moves never capture, and are scored 0.
+//    (Reference: https://www.chessprogramming.org/SEE_-_The_Swap_Algorithm)
+
+const int see_values[8] = { 0, 100, 320, 330, 500, 500, 900, 20000 }; // indexed by piecetype
+
+#define MAX_EXCHANGES 32
+
+
+// The least valuable of a set of attackers, returns its type and the piece in `attacker`
+
+piecetype least_valuable(board board, bitboard attackers, bitboard *attacker)
+{
+	static const piecetype order[6] = { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+
+	for (int i = 0; i < 6; i += 1) {
+		bitboard pieces = attackers & extract(board, order[i]);
+
+		if (pieces) {
+			*attacker = pieces & -pieces;
+			return order[i];
+		}
+	}
+
+	return NONE;
+}
+
+
+//  The swap list holds the gain of the side that captured at each step. It is built forward with
+//  every capture made, and then resolved backwards with each side choosing between capturing and
+//  standing pat.
+
+int see(board board, move move)
+{
+	if (move & M_CASTLING) return 0;
+
+	square init = M_INIT(move), dest = M_DEST(move);
+	piecetype moved = piece_on(board, init);
+	bitboard occ = occupied(board);
+
+	bitboard bishops = extract(board, BISHOP) | extract(board, QUEEN);
+	bitboard rooks   = extract(board, ROOK)   | extract(board, QUEEN);
+
+	int gain[MAX_EXCHANGES];
+	gain[0] = see_values[piece_on(board, dest)];
+
+	// en-passant captures take the pawn behind the destination
+	if (moved == PAWN && ((init ^ dest) & 7) && !(occ >> dest & 1)) {
+		gain[0] = see_values[PAWN];
+		occ ^= 1ull << (dest - 8);
+	}
+
+	// the piece standing on the square, that the next capture takes
+	int on_square = see_values[moved];
+
+	if (M_PIECE(move) != moved && moved == PAWN) {
+		gain[0] += see_values[M_PIECE(move)] - see_values[PAWN];
+		on_square = see_values[M_PIECE(move)];
+	}
+
+	occ ^= 1ull << init;
+
+	bitboard attackers = attackers_to(board, dest, occ) & occ;
+	bitboard ours = board.white & occ, theirs = occ &~ board.white;
+	bool us = false; // whose turn it is to capture
+	int depth = 0;
+
+	while (depth + 1 < MAX_EXCHANGES) {
+		bitboard attacker;
+		piecetype piece = least_valuable(board, attackers & (us ? ours : theirs), &attacker);
+
+		if (piece == NONE) break;
+
+		// the king can only capture if the square is no longer defended
+		if (piece == KING && (attackers & (us ? theirs : ours))) break;
+
+		depth += 1;
+		gain[depth] = on_square - gain[depth - 1];
+		on_square = see_values[piece];
+
+		occ ^= attacker;
+
+		// sliders behind the piece that captured join in
+		if (piece == PAWN || piece == BISHOP || piece == QUEEN)
+			attackers |= bishop_attacks(dest, occ) & bishops;
+
+		if (piece == ROOK || piece == QUEEN)
+			attackers |= rook_attacks(dest, occ) & rooks;
+
+		attackers &= occ;
+		us = !us;
+	}
+
+	while (depth > 0) {
+		gain[depth - 1] = -(-gain[depth - 1] > gain[depth] ? -gain[depth - 1] : gain[depth]);
+		depth -= 1;
+	}
+
+	return gain[0];
+}
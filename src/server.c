@@ -0,0 +1,413 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bitbase.h"
+#include "divide.h"
+#include "fen.h"
+#include "legal.h"
+#include "notation.h"
+#include "perft.h"
+
+//  A resident process answering move generation queries, so that many small queries don't each pay
+//  for starting a process and initialising the tables. Commands are read a line at a time, from
+//  stdin or from each connection to a Unix socket, and every command is answered with exactly one
+//  line (a batch with one line per position), so a client can send any number of commands ahead
+//  and match the answers up in order. Answers are buffered and only written out when there is no
+//  more input to read, so a pipelined stream of queries is answered in large writes.
+//
+//    position startpos [moves e2e4 ...]     set the position, answers "ok"
+//    position [fen] <fen> [moves e2e4 ...]
+//    fen                                    the FEN of the position
+//    moves                                  the number of legal moves, and the moves in UCI
+//    perft <depth>                          the leaf count
+//    divide <depth>                         the leaf count, and "move:count" for each root move
+//    stats <depth>                          nodes, captures, e.p., castles, promotions, checks, mates
+//    batch <command>                        run a command (not batch or quit) on each of the
+//      <fen> [moves ...]                    following positions, up to a line "end"
+//      end
+//    isready                                answers "readyok"
+//    quit                                   end the session
+//
+//  Errors are answered with a line "error <message>", in place of the answer they replace. Empty
+//  lines are ignored, and lines longer than the input buffer are answered with "error line too
+//  long" as a whole.
+
+#define SERVER_BUFFER_SIZE (1 << 16)
+#define MAX_SERVER_DEPTH   15
+
+const char startpos_fen[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+typedef struct {
+	int fd;
+	size_t start, end;
+	bool discard, too_long; // skipping the rest of a line too long for the buffer, and the last line was
+	FILE *out;
+	char data[SERVER_BUFFER_SIZE];
+} line_reader;
+
+typedef struct {
+	line_reader in;
+	board board;
+	bool white_to_move;
+	unsigned threads;
+	perft_table *table;
+} session;
+
+
+//  The next line of input without its newline, or NULL at the end of the input, or once the answers
+//  can't be written (the client went away). The answers are flushed only before waiting for more
+//  input. A line too long for the buffer is skipped up to its
+//  newline, and is returned (as its last part) with too_long set, so that it is answered once.
+
+char *read_line(line_reader *in)
+{
+	in->too_long = false;
+
+	for (;;) {
+		char *line = in->data + in->start;
+		char *newline = memchr(line, '\n', in->end - in->start);
+
+		if (newline) {
+			*newline = '\0';
+			if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+
+			in->start = newline + 1 - in->data;
+			in->too_long = in->discard, in->discard = false;
+			return line;
+		}
+
+		if (in->start == 0 && in->end == sizeof in->data - 1)
+			in->discard = true, in->end = 0;
+
+		memmove(in->data, line, in->end - in->start);
+		in->end -= in->start, in->start = 0;
+
+		if (fflush(in->out) != 0 || ferror(in->out)) return NULL;
+		ssize_t n = read(in->fd, in->data + in->end, sizeof in->data - 1 - in->end);
+
+		if (n <= 0) {
+			if (in->end == 0 && !in->discard) return NULL;
+
+			in->data[in->end] = '\0'; // the last line had no newline
+			in->end = 0;
+			in->too_long = in->discard, in->discard = false;
+			return in->data;
+		}
+
+		in->end += n;
+	}
+}
+
+
+char *next_token(char **text)
+{
+	char *token = *text + strspn(*text, " \t");
+	if (*token == '\0') return NULL;
+
+	char *end = token + strcspn(token, " \t");
+	*text = *end ? end + 1 : end;
+	*end = '\0';
+
+	return token;
+}
+
+
+// Set the position from "startpos" or a FEN (optionally after "fen"), followed by moves in UCI. The
+// board must be plausible (see legal.h), as the move generator is not safe on any other.
+
+const char *set_position(session *s, char *text)
+{
+	text += strspn(text, " \t");
+
+	if (strncmp(text, "fen ", 4) == 0) text += 4;
+
+	const char *fen = text;
+	if (strncmp(text, "startpos", 8) == 0) fen = startpos_fen, text += 8;
+
+	unsigned halfmove, fullmove;
+	board pos;
+	bool white_to_move;
+	const char *rest = parse_fen_fields(fen, &pos, &white_to_move, &halfmove, &fullmove);
+
+	if (!rest || (*rest && *rest != ' ') || !is_plausible_board(pos)) return "invalid position";
+	if (fen == text) text += rest - fen;
+
+	char *token = next_token(&text);
+
+	if (token && strcmp(token, "moves") != 0) return "invalid position";
+
+	while ((token = next_token(&text))) {
+		movebuffer moves = generate_moves(pos);
+		bool ok = strlen(token) <= 5;
+		move move = ok ? parse_uci(token, pos, &moves, white_to_move, &ok) : 0;
+
+		if (!ok) return "illegal move";
+
+		pos = play_move(pos, move);
+		white_to_move = !white_to_move;
+	}
+
+	s->board = pos;
+	s->white_to_move = white_to_move;
+	return NULL;
+}
+
+
+bool read_depth(char *text, unsigned *depth)
+{
+	char *token = next_token(&text), *end;
+	if (!token) return false;
+
+	*depth = strtoul(token, &end, 10);
+	return *end == '\0' && *depth <= MAX_SERVER_DEPTH;
+}
+
+
+size_t server_perft(session *s, unsigned depth)
+{
+	return depth ? parallel_perft(s->board, depth, s->threads, s->table) : 1;
+}
+
+
+void write_moves(session *s)
+{
+	FILE *out = s->in.out;
+	movebuffer moves = generate_moves(s->board);
+	char uci[MAX_MOVE_NOTATION];
+
+	fprintf(out, "%zu", moves.count + popcnt(moves.pawn_push));
+
+	for (size_t i = 0; i < moves.count; i += 1) {
+		format_uci(uci, s->board, moves.buffer[i], s->white_to_move);
+		fprintf(out, " %s", uci);
+	}
+
+	for bits(moves.pawn_push) {
+		format_uci(uci, s->board, pawn_push_move(s->board, ctz(moves.pawn_push)), s->white_to_move);
+		fprintf(out, " %s", uci);
+	}
+
+	fputc('\n', out);
+}
+
+
+void write_divide(session *s, unsigned depth)
+{
+	FILE *out = s->in.out;
+	divide_entry entries[MAX_MOVES];
+	size_t count = perft_divide(s->board, depth, s->threads, s->table, entries);
+	size_t total = 0;
+
+	for (size_t i = 0; i < count; i += 1) total += entries[i].nodes;
+	fprintf(out, "%zu", total);
+
+	for (size_t i = 0; i < count; i += 1) {
+		char uci[MAX_MOVE_NOTATION];
+		format_uci(uci, s->board, entries[i].move, s->white_to_move);
+		fprintf(out, " %s:%zu", uci, entries[i].nodes);
+	}
+
+	fputc('\n', out);
+}
+
+
+void write_stats(session *s, unsigned depth)
+{
+	perft_stats stats = {};
+	stats_perft(s->board, depth, &stats);
+
+	fprintf(s->in.out, "%zu %zu %zu %zu %zu %zu %zu\n", stats.nodes, stats.captures, stats.en_passant,
+	        stats.castles, stats.promotions, stats.checks, stats.mates);
+}
+
+
+bool run_command(session *s, char *line, bool batch);
+
+
+// Run a command on each of the positions that follow, up to "end", the position is kept. A command
+// without an answer of its own (nothing, quit or batch) answers every position with an error.
+
+void run_batch(session *s, const char *text)
+{
+	char *line, command[SERVER_BUFFER_SIZE], copy[SERVER_BUFFER_SIZE];
+	board pos = s->board;
+	bool white_to_move = s->white_to_move;
+
+	strcpy(command, text); // the line is overwritten as the positions are read
+	strcpy(copy, command);
+
+	char *rest = copy, *name = next_token(&rest);
+	bool invalid = !name || strcmp(name, "quit") == 0 || strcmp(name, "batch") == 0;
+
+	while ((line = read_line(&s->in)) && (s->in.too_long || strcmp(line, "end") != 0)) {
+		const char *error = s->in.too_long ? "line too long" : invalid ? "invalid batch command" : set_position(s, line);
+
+		if (error) {
+			fprintf(s->in.out, "error %s\n", error);
+			continue;
+		}
+
+		strcpy(copy, command);
+		run_command(s, copy, true);
+	}
+
+	s->board = pos;
+	s->white_to_move = white_to_move;
+}
+
+
+// Run a command and write its answer, returns false to end the session
+
+bool run_command(session *s, char *line, bool batch)
+{
+	FILE *out = s->in.out;
+	char *command = next_token(&line);
+	unsigned depth;
+
+	if (!command) return true;
+
+	if (strcmp(command, "quit") == 0) return false;
+
+	if (strcmp(command, "isready") == 0)
+		fprintf(out, "readyok\n");
+
+	else if (strcmp(command, "position") == 0) {
+		const char *error = set_position(s, line);
+
+		if (error) fprintf(out, "error %s\n", error);
+		else fprintf(out, "ok\n");
+	}
+
+	else if (strcmp(command, "fen") == 0) {
+		char fen[MAX_FEN_LENGTH];
+		write_fen(fen, s->board, s->white_to_move, 0, 1);
+		fprintf(out, "%s\n", fen);
+	}
+
+	else if (strcmp(command, "moves") == 0)
+		write_moves(s);
+
+	else if (strcmp(command, "perft") == 0 || strcmp(command, "divide") == 0 || strcmp(command, "stats") == 0) {
+		if (!read_depth(line, &depth) || (depth == 0 && command[0] != 'p'))
+			fprintf(out, "error invalid depth\n");
+
+		else if (command[0] == 'p') fprintf(out, "%zu\n", server_perft(s, depth));
+		else if (command[0] == 'd') write_divide(s, depth);
+		else write_stats(s, depth);
+	}
+
+	else if (strcmp(command, "batch") == 0 && !batch)
+		run_batch(s, line);
+
+	else
+		fprintf(out, "error unknown command %s\n", command);
+
+	return true;
+}
+
+
+void *run_session(void *arg)
+{
+	session *s = arg;
+	char *line;
+	bool ok;
+
+	s->board = parse_fen(startpos_fen, &s->white_to_move, &ok);
+
+	while ((line = read_line(&s->in))) {
+		if (s->in.too_long) fprintf(s->in.out, "error line too long\n");
+		else if (!run_command(s, line, false)) break;
+	}
+
+	fclose(s->in.out);
+	free(s);
+	return NULL;
+}
+
+
+session *open_session(int in, int out, unsigned threads, perft_table *table)
+{
+	session *s = malloc(sizeof *s);
+
+	s->in = (line_reader) { .fd = in, .out = fdopen(out, "w") };
+	s->threads = threads, s->table = table;
+
+	setvbuf(s->in.out, NULL, _IOFBF, SERVER_BUFFER_SIZE);
+	return s;
+}
+
+
+// Each connection to the socket is a session of its own, on a thread of its own
+
+int serve_socket(const char *path, unsigned threads, perft_table *table)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (strlen(path) >= sizeof address.sun_path) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return 1;
+	}
+
+	strcpy(address.sun_path, path);
+	unlink(path);
+
+	if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof address) != 0 || listen(listener, 64) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	for (int fd; (fd = accept(listener, NULL, NULL)) >= 0;) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, run_session, open_session(fd, fd, threads, table)) == 0)
+			pthread_detach(thread);
+	}
+
+	perror("accept");
+	return 1;
+}
+
+
+//  usage: server [-t threads] [-H megabytes] [-u socket]
+//    -t  number of threads for each perft (1 by default, sessions on a socket already run in parallel)
+//    -H  size of a perft hash table shared by all sessions, by default perft is run without one
+//    -u  listen on a Unix socket instead of reading stdin
+
+int main(int argc, char **argv)
+{
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	unsigned threads = 1;
+	size_t megabytes = 0;
+	const char *path = NULL;
+
+	for (int opt; (opt = getopt(argc, argv, "t:H:u:")) != -1;) {
+		switch (opt) {
+			case 't': threads = strtoul(optarg, NULL, 10); break;
+			case 'H': megabytes = strtoull(optarg, NULL, 10); break;
+			case 'u': path = optarg; break;
+			default : fprintf(stderr, "usage: %s [-t threads] [-H megabytes] [-u socket]\n", argv[0]); return 1;
+		}
+	}
+
+	if (threads == 0) threads = 1;
+
+	// a client that goes away before reading its answers only ends its own session
+	signal(SIGPIPE, SIG_IGN);
+
+	perft_table storage, *table = NULL;
+	if (megabytes) storage = create_perft_table(megabytes), table = &storage;
+
+	if (path) return serve_socket(path, threads, table);
+
+	run_session(open_session(STDIN_FILENO, dup(STDOUT_FILENO), threads, table));
+	return 0;
+}
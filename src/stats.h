@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+//  Optional counters of how often move generation takes its rare (slow) paths, to tune the branch
+//  layout and the PGO profile against a real workload. They are compiled in with -DMOVEGEN_STATS,
+//  and otherwise every MOVEGEN_STAT compiles to nothing (the condition is not even evaluated).
+//
+//  Each thread counts into its own block, so the counters cost a single add in the hot path with
+//  no sharing between cores. The blocks are linked into a global list when a thread first counts
+//  something, and outlive the thread, so that the totals can be summed over every thread on demand.
+//  Note: the pawn stats are counted each time the pawn targets are generated, which staged move
+//  generation does twice per position (for the captures and the quiets).
+
+enum movegen_stat {
+	STAT_POSITIONS,            // positions that move generation (or counting) was run on
+	STAT_CHECK,                // ... in check
+	STAT_DOUBLE_CHECK,         // ... in double check, where only the king can move
+	STAT_PINNED,               // ... with at least one pinned piece
+	STAT_EN_PASSANT,           // ... with an en-passant square
+	STAT_EN_PASSANT_PIN_TEST,  // ... where the en-passant capture had to be tested for a pin
+	STAT_EN_PASSANT_PINNED,    // ... where the en-passant capture was pinned
+	STAT_PROMOTIONS,           // ... where a pawn can promote
+	STAT_CASTLING,             // ... where castling was tested (the king has castling rights)
+	COUNT_MOVEGEN_STATS
+};
+
+const char *movegen_stat_names[COUNT_MOVEGEN_STATS] = {
+	"positions", "check", "double check", "pinned", "en-passant",
+	"en-passant pin test", "en-passant pinned", "promotions", "castling",
+};
+
+
+#ifdef MOVEGEN_STATS
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct movegen_stats { uint64_t counts[COUNT_MOVEGEN_STATS]; struct movegen_stats *next; } movegen_stats;
+
+movegen_stats *all_movegen_stats;
+__thread movegen_stats *thread_movegen_stats;
+
+
+movegen_stats *register_movegen_stats()
+{
+	movegen_stats *stats = calloc(1, sizeof *stats);
+	stats->next = __atomic_load_n(&all_movegen_stats, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&all_movegen_stats, &stats->next, stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return thread_movegen_stats = stats;
+}
+
+
+// Counters are only written by their own thread, the atomic accesses are plain loads and stores on
+// x86 but allow them to be read at any time from other threads.
+
+void add_movegen_stat(enum movegen_stat stat, uint64_t n)
+{
+	movegen_stats *stats = thread_movegen_stats;
+
+	if (__builtin_expect(stats == NULL, 0))
+		stats = register_movegen_stats();
+
+	uint64_t count = __atomic_load_n(&stats->counts[stat], __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->counts[stat], count + n, __ATOMIC_RELAXED);
+}
+
+#define MOVEGEN_STAT(stat, condition) add_movegen_stat(stat, (condition) != 0)
+
+
+void total_movegen_stats(uint64_t *counts)
+{
+	for (int i = 0; i < COUNT_MOVEGEN_STATS; i += 1) counts[i] = 0;
+
+	for (movegen_stats *s = __atomic_load_n(&all_movegen_stats, __ATOMIC_ACQUIRE); s; s = s->next)
+		for (int i = 0; i < COUNT_MOVEGEN_STATS; i += 1)
+			counts[i] += __atomic_load_n(&s->counts[i], __ATOMIC_RELAXED);
+}
+
+
+// Reset the counters of every thread, this is only exact while no other thread is counting.
+
+void reset_movegen_stats()
+{
+	for (movegen_stats *s = __atomic_load_n(&all_movegen_stats, __ATOMIC_ACQUIRE); s; s = s->next)
+		for (int i = 0; i < COUNT_MOVEGEN_STATS; i += 1)
+			__atomic_store_n(&s->counts[i], 0, __ATOMIC_RELAXED);
+}
+
+
+void print_movegen_stats(FILE *out)
+{
+	uint64_t counts[COUNT_MOVEGEN_STATS];
+	total_movegen_stats(counts);
+
+	double positions = counts[STAT_POSITIONS] ? counts[STAT_POSITIONS] : 1;
+
+	fprintf(out, "movegen stat                    count    %% of positions\n");
+	fprintf(out, "======================================================\n");
+
+	for (int i = 0; i < COUNT_MOVEGEN_STATS; i += 1)
+		fprintf(out, "%-22s %14llu %12.4f%%\n", movegen_stat_names[i], (unsigned long long) counts[i],
+		        100.0 * counts[i] / positions);
+}
+
+#else
+
+#define MOVEGEN_STAT(stat, condition) ((void) 0)
+
+#endif
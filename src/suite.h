@@ -0,0 +1,260 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "epd.h"
+#include "perft.h"
+#include "timer.h"
+
+//  Perft test suites, read from EPD files in the usual perftsuite format, with the expected leaf
+//  counts given as operations after the FEN, and optionally a name:
+//
+//    rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ;D1 20 ;D2 400 ;D3 8902 ;id "startpos"
+//
+//  Each position is tested at the deepest expected depth (up to a maximum). Counts at shallower
+//  depths are implied by the deepest one in practice, so they are only run to find the shallowest
+//  depth that fails when the deepest one does.
+
+#define MAX_SUITE_DEPTH 15
+#define MAX_SUITE_NAME  32
+
+typedef struct {
+	board board;
+	bool white_to_move;
+	size_t line;
+	size_t expected[MAX_SUITE_DEPTH + 1];
+	uint32_t depths;        // the depths with an expected count (bit n for depth n), as counts may be 0
+	unsigned depth;
+	char name[MAX_SUITE_NAME];
+	char fen[MAX_FEN_LENGTH];
+} suite_position;
+
+typedef struct {
+	size_t nodes, expected;
+	unsigned depth;
+	bool passed;
+	double seconds;
+} suite_result;
+
+
+// Parse the ";Dn count" and ";id "name"" operations of a record, any other operations are ignored.
+
+void parse_suite_operations(suite_position *position, const char *ops, size_t length)
+{
+	const char *end = ops + length;
+
+	while (ops < end) {
+		if (*ops == 'D' && ops + 1 < end && '1' <= ops[1] && ops[1] <= '9') {
+			unsigned depth = 0;
+			size_t count = 0;
+
+			for (ops += 1; ops < end && '0' <= *ops && *ops <= '9'; ops += 1)
+				depth = depth * 10 + (*ops - '0');
+
+			while (ops < end && *ops == ' ') ops += 1;
+
+			for (; ops < end && '0' <= *ops && *ops <= '9'; ops += 1)
+				count = count * 10 + (*ops - '0');
+
+			if (depth <= MAX_SUITE_DEPTH) position->expected[depth] = count, position->depths |= 1u << depth;
+			continue;
+		}
+
+		if (end - ops > 4 && ops[0] == 'i' && ops[1] == 'd' && ops[2] == ' ' && ops[3] == '"') {
+			size_t n = 0;
+
+			for (ops += 4; ops < end && *ops != '"'; ops += 1)
+				if (n + 1 < MAX_SUITE_NAME) position->name[n++] = *ops;
+
+			position->name[n] = '\0';
+			continue;
+		}
+
+		ops += 1;
+	}
+}
+
+
+//  Read every position of a suite, up to a maximum depth. Lines that can't be parsed are reported
+//  to stderr and skipped. Returns the number of positions (the array is allocated), or 0 if there
+//  are none.
+
+size_t load_suite(epd_file file, unsigned max_depth, suite_position **positions)
+{
+	size_t count = 0, capacity = 64;
+	suite_position *list = malloc(capacity * sizeof *list);
+
+	epd_reader reader = epd_file_part(file, 0, 1);
+	epd_record record;
+	bool ok;
+
+	// line numbers are counted up to each record, as read_epd skips empty lines and comments
+	const char *counted = file.data;
+	size_t line = 1;
+
+	while (read_epd(&reader, &record, &ok)) {
+		for (const char *c; (c = memchr(counted, '\n', record.line - counted)); counted = c + 1)
+			line += 1;
+
+		if (!ok) {
+			fprintf(stderr, "line %zu: invalid FEN: %.*s\n", line, (int) record.line_length, record.line);
+			continue;
+		}
+
+		if (count == capacity) list = realloc(list, (capacity *= 2) * sizeof *list);
+		suite_position *position = &list[count];
+
+		*position = (suite_position) { .board = record.board, .white_to_move = record.white_to_move, .line = line };
+		parse_suite_operations(position, record.operations, record.operations_length);
+		write_fen(position->fen, record.board, record.white_to_move, record.halfmove, record.fullmove);
+
+		for (unsigned depth = 1; depth <= max_depth && depth <= MAX_SUITE_DEPTH; depth += 1)
+			if (position->depths >> depth & 1) position->depth = depth;
+
+		if (position->depth) count += 1;
+	}
+
+	*positions = list;
+	return count;
+}
+
+
+//  Test a single position. The leaf count is compared at the deepest expected depth, if it doesn't
+//  match the shallower depths are run to find the first one that fails, as that is usually what is
+//  needed to track down the bug.
+
+suite_result run_suite_position(suite_position *position, unsigned threads, perft_table *table)
+{
+	double start = wall_seconds();
+	unsigned depth = position->depth;
+
+	size_t nodes = parallel_perft(position->board, depth, threads, table);
+	suite_result result = { nodes, position->expected[depth], depth, nodes == position->expected[depth], 0 };
+
+	if (!result.passed) {
+		for (depth = 1; depth < position->depth; depth += 1) {
+			if (!(position->depths >> depth & 1)) continue;
+
+			nodes = parallel_perft(position->board, depth, threads, table);
+
+			if (nodes != position->expected[depth]) {
+				result = (suite_result) { nodes, position->expected[depth], depth, false, 0 };
+				break;
+			}
+		}
+	}
+
+	result.seconds = wall_seconds() - start;
+	return result;
+}
+
+
+//  Results are printed as each position finishes, either as a table or in a machine-readable
+//  format: one line per position of tab-separated fields,
+//
+//    line  name  PASS|FAIL  depth  nodes  expected  seconds  nodes/s  FEN
+//
+//  where for a failure the depth is the shallowest that failed, with its nodes and expected count.
+
+typedef struct {
+	suite_position *positions;
+	suite_result *results;
+	size_t count, next;
+	unsigned threads;
+	perft_table *table;
+	bool machine_readable;
+	pthread_mutex_t output;
+} suite_runner;
+
+
+void print_suite_result(suite_runner *runner, size_t index)
+{
+	suite_position *position = &runner->positions[index];
+	suite_result *result = &runner->results[index];
+
+	double nps = result->seconds > 0 ? result->nodes / result->seconds : 0;
+	const char *name = position->name[0] ? position->name : "-";
+
+	pthread_mutex_lock(&runner->output);
+
+	if (runner->machine_readable) {
+		printf("%zu\t%s\t%s\t%u\t%zu\t%zu\t%.6f\t%.0f\t%s\n", position->line, name,
+		       result->passed ? "PASS" : "FAIL", result->depth, result->nodes, result->expected,
+		       result->seconds, nps, position->fen);
+	}
+
+	else {
+		if (position->name[0]) printf("%-25s", position->name);
+		else printf("line %-20zu", position->line);
+
+		printf(" %-5u       %9zu\t\t(%.0f mnps)", result->depth, result->nodes, nps / 1e6);
+		if (!result->passed) printf("  FAILED, expected %zu", result->expected);
+		printf("\n");
+	}
+
+	fflush(stdout);
+	pthread_mutex_unlock(&runner->output);
+}
+
+
+//  A suite of many shallow positions is scheduled one position per thread at a time, as splitting
+//  each position over all threads would spend more time starting and joining them than searching.
+//  When there are too few positions to keep every thread busy, they are run one after another
+//  with each of them split over all threads instead.
+
+#define SUITE_POSITIONS_PER_THREAD 4
+
+void *suite_worker_main(void *arg)
+{
+	suite_runner *runner = arg;
+
+	for (;;) {
+		size_t index = __atomic_fetch_add(&runner->next, 1, __ATOMIC_RELAXED);
+		if (index >= runner->count) break;
+
+		runner->results[index] = run_suite_position(&runner->positions[index], 1, runner->table);
+		print_suite_result(runner, index);
+	}
+
+	return NULL;
+}
+
+
+// Run a suite and return the number of failed positions, the results of each position are written
+// to `results` (in the same order as the positions).
+
+size_t run_suite(suite_position *positions, suite_result *results, size_t count, unsigned threads,
+                 perft_table *table, bool machine_readable)
+{
+	suite_runner runner = { positions, results, count, 0, threads, table, machine_readable, PTHREAD_MUTEX_INITIALIZER };
+
+	if (threads > 1 && count >= (size_t) threads * SUITE_POSITIONS_PER_THREAD) {
+		pthread_t *handles = calloc(threads, sizeof *handles);
+
+		for (unsigned i = 1; i < threads; i += 1)
+			pthread_create(&handles[i], NULL, suite_worker_main, &runner);
+
+		suite_worker_main(&runner);
+
+		for (unsigned i = 1; i < threads; i += 1)
+			pthread_join(handles[i], NULL);
+
+		free(handles);
+	}
+
+	else for (size_t i = 0; i < count; i += 1) {
+		results[i] = run_suite_position(&positions[i], threads, table);
+		print_suite_result(&runner, i);
+	}
+
+	pthread_mutex_destroy(&runner.output);
+
+	size_t failed = 0;
+
+	for (size_t i = 0; i < count; i += 1)
+		failed += !results[i].passed;
+
+	return failed;
+}
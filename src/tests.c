@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "bitbase.h"
+#include "corpus.h"
+#include "fen.h"
+#include "game.h"
+#include "legal.h"
+#include "movegen.h"
+#include "notation.h"
+#include "pack.h"
+#include "perft.h"
+#include "pseudo.h"
+#include "search.h"
+#include "see.h"
+#include "tracked.h"
+
+//  Checks of the alternative move generators against generate_moves and perft, over the positions
+//  of the benchmark corpus (see corpus.h), and of the other layers against known values. The perft
+//  counts themselves are tested by main.c. Build it with each option of the bench target.
+
+
+// The batched generators must give the same counts and moves as generate_moves, in every lane
+
+#define BATCH_CHECK_SIZE 1024
+
+bool check_batch()
+{
+	size_t counts[BATCH_CHECK_SIZE];
+	movebuffer *moves = malloc(BATCH_CHECK_SIZE * sizeof *moves);
+	bool passed = true;
+
+	for (size_t i = 0; passed && i < count_board_samples; i += BATCH_CHECK_SIZE) {
+		size_t n = (count_board_samples - i < BATCH_CHECK_SIZE) ? count_board_samples - i : BATCH_CHECK_SIZE;
+
+		count_moves_batch(board_samples + i, n, counts);
+		generate_moves_batch(board_samples + i, n, moves);
+
+		for (size_t j = 0; passed && j < n; j += 1) {
+			movebuffer expected = generate_moves(board_samples[i + j]);
+
+			passed &= counts[j] == expected.count + popcnt(expected.pawn_push);
+			passed &= moves[j].count == expected.count && moves[j].pawn_push == expected.pawn_push;
+			passed &= memcmp(moves[j].buffer, expected.buffer, expected.count * sizeof *expected.buffer) == 0;
+
+			if (!passed) {
+				char fen[MAX_FEN_LENGTH];
+				write_fen(fen, board_samples[i + j], true, 0, 1);
+				printf("batched moves differ from generate_moves: %s\n", fen);
+			}
+		}
+	}
+
+	free(moves);
+	return passed;
+}
+
+
+// Tracked boards must give the same perft counts as plain boards, their state being updated
+// incrementally all the way down
+
+bool check_tracked()
+{
+	bool passed = true;
+
+	for (size_t i = 0; i < count_bench_positions; i += 1) {
+		bool white_to_move, ok;
+		board board = parse_fen(bench_positions[i].FEN, &white_to_move, &ok);
+		unsigned depth = bench_positions[i].depth;
+
+		tracked_board pos;
+		init_tracked_board(&pos, board, white_to_move);
+
+		if (tracked_perft(&pos, depth) != perft(board, depth)) {
+			printf("tracked boards give different perft counts: %s\n", bench_positions[i].name);
+			passed = false;
+		}
+	}
+
+	return passed;
+}
+
+
+// The pseudo-legal and staged generators must give the same perft counts, and search the same tree
+
+bool check_pseudo_legal()
+{
+	bool passed = true;
+
+	for (size_t i = 0; i < count_bench_positions; i += 1) {
+		board pos = bench_board(i);
+		size_t nodes[3] = {};
+		int scores[3];
+
+		for (enum alphabeta_mode mode = MOVES_FULL; mode <= MOVES_PSEUDO; mode += 1)
+			scores[mode] = alphabeta(pos, ALPHABETA_DEPTH, -MATE_SCORE, MATE_SCORE, mode, &nodes[mode]);
+
+		if (pseudo_perft(pos, bench_positions[i].depth) != perft(pos, bench_positions[i].depth)
+		 || nodes[MOVES_PSEUDO] != nodes[MOVES_FULL] || scores[MOVES_PSEUDO] != scores[MOVES_FULL]) {
+			printf("pseudo-legal moves give different results: %s\n", bench_positions[i].name);
+			passed = false;
+		}
+
+		if (nodes[MOVES_STAGED] != nodes[MOVES_FULL] || scores[MOVES_STAGED] != scores[MOVES_FULL]) {
+			printf("staged moves give different results: %s\n", bench_positions[i].name);
+			passed = false;
+		}
+	}
+
+	return passed;
+}
+
+
+//  is_legal must accept exactly the moves of generate_moves, out of every 16 bit value, and
+//  gives_check must agree with the checks found by generating the position after each of them.
+//  Every 16th sample position is tested, as testing every value takes a while.
+
+#define LEGAL_CHECK_STRIDE 16
+
+bool check_is_legal()
+{
+	for (size_t i = 0; i < count_board_samples; i += LEGAL_CHECK_STRIDE) {
+		board pos = board_samples[i];
+		movebuffer moves = generate_moves(pos);
+		uint64_t legal[1 << 10] = {};
+		bool passed = true;
+
+		for (size_t j = 0; j < moves.count; j += 1)
+			legal[moves.buffer[j] >> 6] |= 1ull << (moves.buffer[j] & 63);
+
+		for bits(moves.pawn_push) {
+			move push = pawn_push_move(pos, ctz(moves.pawn_push));
+			legal[push >> 6] |= 1ull << (push & 63);
+		}
+
+		for (unsigned value = 0; passed && value < 1 << 16; value += 1) {
+			move move = value;
+			bool expected = legal[move >> 6] >> (move & 63) & 1;
+
+			passed &= is_legal(pos, move) == expected;
+
+			if (expected) {
+				bitboard checks;
+				generate_movegen_info(play_move(pos, move), &checks);
+				passed &= gives_check(pos, move) == (checks != 0);
+			}
+		}
+
+		if (!passed) {
+			char fen[MAX_FEN_LENGTH];
+			write_fen(fen, pos, true, 0, 1);
+			printf("is_legal or gives_check differ from generate_moves: %s\n", fen);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//  The textbook values of static exchange evaluation: an undefended pawn, an even trade, a pawn
+//  defended through an x-ray by doubled rooks, and a promotion that is then captured.
+
+bool check_see()
+{
+	static const struct { const char *fen; move move; int value; } tests[] = {
+		{ "4k3/8/8/3p4/8/8/8/3RK3 w - -",         M(3, 35, ROOK),   100 },
+		{ "4k3/8/4p3/3p4/4P3/8/8/4K3 w - -",       M(28, 35, PAWN),  0 },
+		{ "3r2k1/3r4/8/3p4/8/8/3R4/3R2K1 w - -",   M(11, 35, ROOK),  -400 },
+		{ "k6r/4P3/8/8/8/8/8/4K3 w - -",           M(52, 60, QUEEN), -100 },
+	};
+
+	bool passed = true;
+
+	for (size_t i = 0; i < sizeof tests / sizeof *tests; i += 1) {
+		bool white_to_move, ok;
+		board pos = parse_fen(tests[i].fen, &white_to_move, &ok);
+		int value = see(pos, tests[i].move);
+
+		if (!ok || value != tests[i].value) {
+			printf("see gives %d instead of %d: %s\n", value, tests[i].value, tests[i].fen);
+			passed = false;
+		}
+	}
+
+	return passed;
+}
+
+
+// Make a move of the game given in UCI, returns false if it is illegal or the history is full
+
+bool make_uci_move(game *game, const char *uci)
+{
+	movebuffer moves = generate_moves(game->board);
+	bool ok;
+	move move = parse_uci(uci, game->board, &moves, game->white_to_move, &ok);
+
+	if (!ok) return false;
+	return is_pawn_push(move) ? make_game_pawn_push(game, M_DEST(move)) : make_game_move(game, move);
+}
+
+
+//  A knight shuffle from the start position must repeat it, with the same hash as the incremental
+//  updates, and unmaking the moves must restore the hash, the clocks and the repetition filter.
+//  Once the history is full, moves must be refused with the game left as it was, and trimming it
+//  must keep the repetitions since the last irreversible move, with the filter counting the rest.
+
+bool check_game_state()
+{
+	static game game;
+	static const char *shuffle[4] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+
+	init_game_fen(&game, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+	board start = game.board;
+	uint64_t hash = game.hash;
+	bool passed = true;
+
+	for (int i = 0; i < 4; i += 1) {
+		passed &= !is_repetition(&game);
+		passed &= make_uci_move(&game, shuffle[i]);
+		passed &= game.hash == hash_position(game.board, game.white_to_move);
+	}
+
+	passed &= game.hash == hash && is_repetition(&game) && is_draw(&game);
+	passed &= game.halfmove == 4 && game.fullmove == 3 && game.white_to_move;
+
+	for (int i = 0; i < 4; i += 1) unmake_game_move(&game);
+
+	passed &= game.hash == hash && memcmp(&game.board, &start, sizeof start) == 0 && !is_repetition(&game);
+	passed &= game.ply == 0 && game.halfmove == 0 && game.fullmove == 1 && game.white_to_move;
+
+	for (size_t ply = 0; ply < MAX_GAME_PLIES; ply += 1)
+		passed &= make_uci_move(&game, shuffle[ply & 3]);
+
+	passed &= !make_uci_move(&game, shuffle[0]) && game.ply == MAX_GAME_PLIES && game.hash == hash;
+
+	trim_game_history(&game);
+	passed &= game.ply == MAX_GAME_PLIES / 2 && is_repetition(&game);
+
+	for (int i = 0; i < 4; i += 1)
+		passed &= make_uci_move(&game, shuffle[i]);
+
+	passed &= game.hash == hash && is_repetition(&game) && make_uci_move(&game, "e2e4");
+
+	trim_game_history(&game);
+	size_t counted = 0;
+	for (size_t i = 0; i < REPETITION_FILTER_SIZE; i += 1) counted += game.filter[i];
+
+	passed &= game.ply == 0 && counted == 1 && !is_repetition(&game);
+
+	if (!passed) printf("the game state gives wrong results for a knight shuffle\n");
+	return passed;
+}
+
+
+//  A blocked pawn push has an index past the other moves, as the pushes are indexed by their
+//  destination, so the writer must check it is legal rather than only that the index is in range.
+//  A board the reader would reject (here without a black king) must not be written either.
+
+bool check_pack_legality()
+{
+	bool white_to_move, ok;
+	board pos = parse_fen("4k3/8/8/8/8/4n3/P3P3/4K3 w - -", &white_to_move, &ok);
+
+	pack_writer writer = { .out = tmpfile() };
+	if (!writer.out) return false;
+
+	move blocked = M(12, 20, PAWN), push = M(8, 16, PAWN);
+	bool passed = ok && !write_pack_record(&writer, pos, white_to_move, &blocked, 1);
+	passed &= write_pack_record(&writer, pos, white_to_move, &push, 1) && writer.records == 1;
+
+	board kingless = parse_fen("8/8/8/8/8/8/8/K7 w - -", &white_to_move, &ok);
+	passed &= ok && !write_pack_record(&writer, kingless, white_to_move, NULL, 0) && writer.records == 1;
+	passed &= close_pack_writer(&writer);
+
+	if (!passed) printf("the pack writer accepts an illegal pawn push or an implausible board\n");
+	return passed;
+}
+
+
+bool is_capture_or_promotion(board pos, move move)
+{
+	bitboard to = 1ull << M_DEST(move);
+	bool pawn = piece_on(pos, M_INIT(move)) == PAWN;
+
+	return (to & occupied(pos) &~ pos.white) || (pawn && ((M_INIT(move) ^ M_DEST(move)) & 7)) || (pawn && (to & RANK8));
+}
+
+
+// The stages of every sample position together must give the moves of generate_moves, each of
+// them once, with only the captures and promotions in the captures stage
+
+bool check_move_stages()
+{
+	for (size_t i = 0; i < count_board_samples; i += 1) {
+		board pos = board_samples[i];
+		movebuffer all = generate_moves(pos), moves;
+		move staged[MAX_MOVES];
+		size_t count = 0;
+		bitboard pushes = 0;
+		bool passed = true;
+
+		move_stages stages;
+		enum move_stage stage;
+
+		for (init_move_stages(&stages, pos); (stage = next_move_stage(&stages, &moves));) {
+			for (size_t j = 0; j < moves.count; j += 1) {
+				move move = moves.buffer[j];
+
+				if (stage == STAGE_CAPTURES) passed &= is_capture_or_promotion(pos, move);
+				if (stage == STAGE_QUIETS)   passed &= !is_capture_or_promotion(pos, move);
+				if (count < MAX_MOVES) staged[count++] = move;
+			}
+
+			passed &= !(pushes & moves.pawn_push);
+			pushes |= moves.pawn_push;
+		}
+
+		passed &= count == all.count && pushes == all.pawn_push;
+
+		for (size_t j = 0; passed && j < count; j += 1) {
+			size_t found = 0;
+
+			for (size_t k = 0; k < all.count; k += 1)
+				found += (all.buffer[k] == staged[j]);
+
+			for (size_t k = j + 1; k < count; k += 1)
+				found += (staged[k] == staged[j]);
+
+			passed &= (found == 1);
+		}
+
+		if (!passed) {
+			char fen[MAX_FEN_LENGTH];
+			write_fen(fen, pos, true, 0, 1);
+			printf("staged moves differ from generate_moves: %s\n", fen);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//  usage: tests [-s pext|magic]
+//    -s  slider backend, for builds without BMI2 (by default the one picked for this CPU)
+//
+//  Exits with status 1 if any check fails.
+
+int main(int argc, char **argv)
+{
+	for (int opt; (opt = getopt(argc, argv, "s:")) != -1;) {
+		switch (opt) {
+#ifndef __BMI2__
+			case 's': slider_backend = (optarg[0] == 'm') ? SLIDERS_MAGIC : SLIDERS_PEXT; break;
+#endif
+			default : fprintf(stderr, "usage: %s [-s pext|magic]\n", argv[0]); return 1;
+		}
+	}
+
+	init_bitbase_tables();
+	init_zobrist_keys();
+
+	collect_corpus();
+
+	bool passed = check_batch();
+	passed &= check_tracked();
+	passed &= check_pseudo_legal();
+	passed &= check_move_stages();
+	passed &= check_is_legal();
+	passed &= check_game_state();
+	passed &= check_pack_legality();
+	passed &= check_see();
+
+	printf("%s\n", passed ? "all checks passed" : "FAILED");
+	return passed ? 0 : 1;
+}
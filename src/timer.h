@@ -0,0 +1,13 @@
+#pragma once
+
+#include <time.h>
+
+// Wall-clock time in seconds, for timing benchmarks (clock() would count the CPU time of all of
+// our threads instead).
+
+double wall_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}